@@ -0,0 +1,93 @@
+WINDOW_BITS = 10
+LOOKAHEAD_BITS = 5
+MAGIC = b'HSF1'
+
+import hashlib
+import struct
+import sys
+
+class BitWriter:
+  def __init__(self):
+    self.out = bytearray()
+    self.acc = 0
+    self.count = 0
+
+  def write(self, value, bits):
+    for i in range(bits - 1, -1, -1):
+      self.acc = (self.acc << 1) | ((value >> i) & 1)
+      self.count += 1
+      if self.count == 8:
+        self.out.append(self.acc)
+        self.acc = 0
+        self.count = 0
+
+  def finish(self):
+    if self.count > 0:
+      self.out.append(self.acc << (8 - self.count))
+    return bytes(self.out)
+
+def heatshrink_compress(data, window_bits=WINDOW_BITS, lookahead_bits=LOOKAHEAD_BITS, max_chain=64):
+  window = 1 << window_bits
+  max_len = 1 << lookahead_bits
+  # a backref pays off once it replaces more bits than 9 per literal byte
+  min_len = (1 + window_bits + lookahead_bits) // 9 + 1
+
+  w = BitWriter()
+  chains = {}
+  pos, n = 0, len(data)
+
+  def insert(p):
+    if p + 1 < n:
+      chains.setdefault(data[p:p+2], []).append(p)
+
+  while pos < n:
+    best_len, best_off = 0, 0
+    limit = min(max_len, n - pos)
+    candidates = chains.get(data[pos:pos+2], [])
+    for cand in reversed(candidates[-max_chain:]):
+      off = pos - cand
+      if off > window: break
+      l = 0
+      while l < limit and data[cand + l] == data[pos + l]: l += 1
+      if l > best_len:
+        best_len, best_off = l, off
+        if l == limit: break
+
+    if best_len >= min_len:
+      w.write(0, 1)
+      w.write(best_off - 1, window_bits)
+      w.write(best_len - 1, lookahead_bits)
+      for p in range(pos, pos + best_len): insert(p)
+      pos += best_len
+    else:
+      w.write(1, 1)
+      w.write(data[pos], 8)
+      insert(pos)
+      pos += 1
+
+  return w.finish()
+
+def compress_image(data, window_bits=WINDOW_BITS, lookahead_bits=LOOKAHEAD_BITS):
+  header = MAGIC + struct.pack('<BBHI', window_bits, lookahead_bits, 0, len(data)) + hashlib.md5(data).digest()
+  return header + heatshrink_compress(data, window_bits, lookahead_bits)
+
+def compress_file(src, dst):
+  with open(src, 'rb') as f: data = f.read()
+  packed = compress_image(data)
+  with open(dst, 'wb') as f: f.write(packed)
+  print('Compressed firmware: {} -> {} bytes ({:.1f}%)'.format(len(data), len(packed), 100. * len(packed) / max(len(data), 1)))
+
+try:
+  Import("env")
+
+  def compress_firmware(source, target, env):
+    firmware = str(target[0])
+    compress_file(firmware, firmware + '.hs')
+
+  env.AddPostAction("$BUILD_DIR/${PROGNAME}.bin", compress_firmware)
+except NameError:
+  if __name__ == '__main__':
+    if len(sys.argv) < 2:
+      print('usage: compress_firmware.py firmware.bin [firmware.bin.hs]')
+      sys.exit(1)
+    compress_file(sys.argv[1], sys.argv[2] if len(sys.argv) > 2 else sys.argv[1] + '.hs')
@@ -0,0 +1,33 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <sys/time.h>
+
+#ifndef CLOCK_EPOCH_VALID_AFTER
+#define CLOCK_EPOCH_VALID_AFTER       1577836800  // 2020-01-01, anything earlier means SNTP hasn't synced yet
+#endif
+
+// Monotonic microseconds since boot, 64 bit: unlike millis() (49.7 days) it doesn't wrap
+// within any realistic uptime, so plain comparisons like `now >= deadline` are safe.
+typedef uint64_t clock_us_t;
+
+#define CLOCK_MS(ms)                  ((clock_us_t)(ms) * 1000ULL)
+#define CLOCK_TO_MS(us)               ((us) / 1000ULL)
+
+inline clock_us_t IRAM_ATTR clock_now() {
+  return (clock_us_t)esp_timer_get_time();
+}
+
+// Wall-clock time (µs since the Unix epoch) of a monotonic timestamp, 0 while the clock isn't set
+inline int64_t clock_to_epoch_us(clock_us_t t) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  if (tv.tv_sec < CLOCK_EPOCH_VALID_AFTER) return 0;
+
+  int64_t epochNow = (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+  return epochNow - (int64_t)(clock_now() - t);
+}
+
+#endif
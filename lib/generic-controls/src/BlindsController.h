@@ -3,6 +3,40 @@
 
 #include <Arduino.h>
 #include <SwitchRelay.h>
+#include <Clock.h>
+#include <Trace.h>
+
+#ifndef BLINDS_ROLLING_TIMELIMIT_MS
+#define BLINDS_ROLLING_TIMELIMIT_MS   90000
+#endif
+
+#ifndef BLINDS_EDGE_POLL_MILLIS
+#define BLINDS_EDGE_POLL_MILLIS       50
+#endif
+
+#ifndef BLINDS_TRAVEL_ALPHA
+#define BLINDS_TRAVEL_ALPHA           0.2f  // EWMA weight of the newest travel time
+#endif
+
+#ifndef BLINDS_TRAVEL_K
+#define BLINDS_TRAVEL_K               3.0f  // cut-off at mean + k*sigma
+#endif
+
+#ifndef BLINDS_TRAVEL_MIN_MARGIN_MS
+#define BLINDS_TRAVEL_MIN_MARGIN_MS   3000  // lower bound for k*sigma, consistent runs have ~0 variance
+#endif
+
+#ifndef BLINDS_TRAVEL_MIN_SAMPLES
+#define BLINDS_TRAVEL_MIN_SAMPLES     3
+#endif
+
+#ifndef BLINDS_TRAVEL_CUTOFF_MARGIN_MS
+#define BLINDS_TRAVEL_CUTOFF_MARGIN_MS  5000  // learned bound widened by this per consecutive cut-off
+#endif
+
+#ifndef BLINDS_TRAVEL_MAX_CUTOFFS
+#define BLINDS_TRAVEL_MAX_CUTOFFS     3     // cap on the widening: a jammed motor runs at most this many extra margins
+#endif
 
 enum class BlindsState : uint8_t { 
   Unknown = 0,
@@ -14,7 +48,17 @@ enum class BlindsState : uint8_t {
   Obstructed
 };
 
+enum class BlindsDirection : uint8_t { Up = 0, Down };
+
+// Learned end-to-end travel time for one direction
+struct BlindsTravelStats {
+  float meanMs = 0;
+  float varianceMs2 = 0;
+  uint16_t samples = 0;
+};
+
 typedef std::function<void()> BlindsStateChangedCallback;
+typedef std::function<void(BlindsDirection)> BlindsTravelStatsChangedCallback;
 
 class BlindsController {
   public:
@@ -22,23 +66,57 @@ class BlindsController {
       blindsStateChangedCb = cb;
     }
 
-    bool loop(unsigned long now) {
-      if (now - lastBlindsRead > 50) {
+    void onTravelStatsChanged(BlindsTravelStatsChangedCallback cb) {
+      travelStatsChangedCb = cb;
+    }
+
+    bool loop(clock_us_t now) {
+      return loop(now, digitalRead(edgeDetectorPin));
+    }
+
+    // Same as loop(now), with the edge detector pin level sampled by the caller
+    bool loop(clock_us_t now, int edgeDetectorLevel) {
+      if (now - lastBlindsRead > CLOCK_MS(pollIntervalMs)) {
         lastBlindsRead = now;
 
-        auto edgeDetectoprValue = digitalRead(edgeDetectorPin) == 0;
+        auto edgeDetectoprValue = edgeDetectorLevel == 0;
         if (edgeDetectoprValue != lastEdgeDetectorValue) {
           lastEdgeDetectorValue = edgeDetectoprValue;
 
           if (edgeDetectoprValue) {
+            auto rollingState = state;
+            unsigned long travelledMs = CLOCK_TO_MS(now - rollingStartTime);
             stop();
 
-            if (state == BlindsState::RollingUp) setState(BlindsState::FullUp);
-            else if (state == BlindsState::RollingDown) setState(BlindsState::FullDown);
+            if (rollingState == BlindsState::RollingUp) {
+              setState(BlindsState::FullUp);
+              endReached(BlindsDirection::Up, travelledMs);
+            }
+            else if (rollingState == BlindsState::RollingDown) {
+              setState(BlindsState::FullDown);
+              endReached(BlindsDirection::Down, travelledMs);
+            }
           }
         }
         else {
-          if ((state == BlindsState::RollingUp || state == BlindsState::RollingDown) && now - rollingStartTime >= BLINDS_ROLLING_TIMELIMIT_MS) {
+          if ((state == BlindsState::RollingUp || state == BlindsState::RollingDown) && now - rollingStartTime >= CLOCK_MS(getRollingLimit(rollingDirection()))) {
+            auto direction = rollingDirection();
+            auto rollingState = state;
+            unsigned long travelledMs = CLOCK_TO_MS(now - rollingStartTime);
+            TRACE(TRACE_BLINDS_OBSTRUCTED, travelledMs, getRollingLimit(direction));
+
+            // Cut off by a learned bound that may just be stale (motor aged, heavier load): the next runs
+            // in this direction get a wider bound, and continuing to the end completes a sample
+            cutOffMs = 0;
+            if (getRollingLimit(direction) < rollingTimeLimitMs) {
+              auto& cutOffs = consecutiveCutOffs[(uint8_t)direction];
+              if (cutOffs < BLINDS_TRAVEL_MAX_CUTOFFS) cutOffs++;
+              if (rollingOrigin == fullEndOpposite(direction)) {
+                cutOffState = rollingState;
+                cutOffMs = travelledMs;
+              }
+            }
+
             stop();
             setState(BlindsState::Obstructed);
           }
@@ -50,10 +128,57 @@ class BlindsController {
       return false;
     }
 
+    void setRollingTimeLimit(unsigned long ms) {
+      rollingTimeLimitMs = ms;
+    }
+
+    void setPollInterval(unsigned long ms) {
+      pollIntervalMs = ms;
+    }
+
+    BlindsTravelStats getTravelStats(BlindsDirection direction) {
+      return travelStats[(uint8_t)direction];
+    }
+
+    void setTravelStats(BlindsDirection direction, const BlindsTravelStats& stats) {
+      travelStats[(uint8_t)direction] = stats;
+      consecutiveCutOffs[(uint8_t)direction] = 0;
+    }
+
+    // Forgets the learned model, runs are cut off at the fixed time limit until it is learned again
+    void resetTravelStats() {
+      setTravelStats(BlindsDirection::Up, BlindsTravelStats());
+      setTravelStats(BlindsDirection::Down, BlindsTravelStats());
+      cutOffMs = 0;
+    }
+
+    // Learned cut-off once enough full runs were seen, the fixed time limit until then;
+    // widened for each run the learned one cut off in a row, until a run reaches the end
+    unsigned long getRollingLimit(BlindsDirection direction) {
+      auto& s = travelStats[(uint8_t)direction];
+      if (s.samples < BLINDS_TRAVEL_MIN_SAMPLES) return rollingTimeLimitMs;
+
+      float margin = BLINDS_TRAVEL_K * sqrtf(s.varianceMs2);
+      if (margin < BLINDS_TRAVEL_MIN_MARGIN_MS) margin = BLINDS_TRAVEL_MIN_MARGIN_MS;
+      margin += (float)consecutiveCutOffs[(uint8_t)direction] * BLINDS_TRAVEL_CUTOFF_MARGIN_MS;
+
+      unsigned long limit = (unsigned long)(s.meanMs + margin);
+      return limit < rollingTimeLimitMs ? limit : rollingTimeLimitMs;
+    }
+
+    uint8_t getEdgeDetectorPin() {
+      return edgeDetectorPin;
+    }
+
     BlindsState getState() {
       return state;
     }
 
+    // When the current state was entered
+    clock_us_t getStateChangedAt() {
+      return stateChangedAt;
+    }
+
     String getStateString() {
       String stateString;
       switch (state) {
@@ -89,10 +214,21 @@ class BlindsController {
 
     void setState(BlindsState s) {
       if (state == s) return;
+      TRACE(TRACE_BLINDS_STATE, (uint8_t)state, (uint8_t)s);
+
+      // Where a run started from; pushUp/pushDown always stop() first
+      if (s == BlindsState::Stopped) stoppedFrom = state;
+      if (s == BlindsState::RollingUp || s == BlindsState::RollingDown) {
+        rollingOrigin = state == BlindsState::Stopped ? stoppedFrom : state;
+        // a cut-off run only carries over into the next run, in the same direction
+        if (rollingOrigin != BlindsState::Obstructed || s != cutOffState) cutOffMs = 0;
+      }
+
       state = s;
+      stateChangedAt = clock_now();
 
       if (state == BlindsState::RollingUp || state == BlindsState::RollingDown)
-        rollingStartTime = millis();
+        rollingStartTime = stateChangedAt;
 
       if (blindsStateChangedCb != NULL)
         blindsStateChangedCb();
@@ -100,9 +236,55 @@ class BlindsController {
 
   private:
     uint8_t edgeDetectorPin;
-    unsigned long lastBlindsRead = 0, rollingStartTime = 0;
+    clock_us_t lastBlindsRead = 0, rollingStartTime = 0, stateChangedAt = 0;
+    unsigned long rollingTimeLimitMs = BLINDS_ROLLING_TIMELIMIT_MS, pollIntervalMs = BLINDS_EDGE_POLL_MILLIS;
     int lastEdgeDetectorValue = 0;
+    BlindsState stoppedFrom = BlindsState::Unknown, rollingOrigin = BlindsState::Unknown, cutOffState = BlindsState::Unknown;
+    BlindsTravelStats travelStats[2];
+    uint8_t consecutiveCutOffs[2] = { 0, 0 };
+    unsigned long cutOffMs = 0;   // time travelled by the last full run the learned bound cut off
     BlindsStateChangedCallback blindsStateChangedCb = NULL;
+    BlindsTravelStatsChangedCallback travelStatsChangedCb = NULL;
+
+    BlindsDirection rollingDirection() {
+      return state == BlindsState::RollingUp ? BlindsDirection::Up : BlindsDirection::Down;
+    }
+
+    // Where a full run in the direction starts from
+    static BlindsState fullEndOpposite(BlindsDirection direction) {
+      return direction == BlindsDirection::Up ? BlindsState::FullDown : BlindsState::FullUp;
+    }
+
+    // Learns full end-to-end runs, and a cut-off full run completed by the run right after it
+    void endReached(BlindsDirection direction, unsigned long travelledMs) {
+      if (rollingOrigin == fullEndOpposite(direction)) learnTravelTime(direction, travelledMs);
+      else if (rollingOrigin == BlindsState::Obstructed && cutOffMs > 0) learnTravelTime(direction, cutOffMs + travelledMs);
+      else return;
+
+      consecutiveCutOffs[(uint8_t)direction] = 0;
+      cutOffMs = 0;
+    }
+
+    // Exponentially weighted mean/variance of full end-to-end runs
+    void learnTravelTime(BlindsDirection direction, unsigned long travelledMs) {
+      auto& s = travelStats[(uint8_t)direction];
+
+      if (s.samples == 0) {
+        s.meanMs = travelledMs;
+        s.varianceMs2 = 0;
+      }
+      else {
+        float diff = (float)travelledMs - s.meanMs;
+        float increment = BLINDS_TRAVEL_ALPHA * diff;
+        s.meanMs += increment;
+        s.varianceMs2 = (1 - BLINDS_TRAVEL_ALPHA) * (s.varianceMs2 + diff * increment);
+      }
+
+      if (s.samples < UINT16_MAX) s.samples++;
+
+      if (travelStatsChangedCb != NULL)
+        travelStatsChangedCb(direction);
+    }
 };
 
 class DcMotorBlindsController : public BlindsController {
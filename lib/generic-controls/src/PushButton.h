@@ -3,6 +3,8 @@
 
 #include <Arduino.h>
 #include <functional>
+#include <Clock.h>
+#include <Trace.h>
 
 enum class ButtonState : uint8_t { Off = 0, On };
 
@@ -27,15 +29,31 @@ class PushButton
       onStateChangedCallback = cb;
     }
 
-    void loop(unsigned long now) {
-      int s = digitalRead(pin);
+    void setThreshold(unsigned int ms)
+    {
+      threshold_ms = ms;
+    }
+
+    // When the current state was first seen on the pin (before debouncing)
+    clock_us_t getStateChangedAt()
+    {
+      return stateChangedAt;
+    }
+
+    void loop(clock_us_t now) {
+      loop(now, digitalRead(pin));
+    }
+
+    // Same as loop(now), with the pin level sampled by the caller
+    void loop(clock_us_t now, int s) {
       if (s != (uint8_t)state) {
         if (s != (uint8_t)newState) {
           newState = (ButtonState)s;
-          newState_ms = now;
+          newState_us = now;
         }
-        else if (now - newState_ms > threshold_ms) {
+        else if (now - newState_us > CLOCK_MS(threshold_ms)) {
           setState(s);
+          stateChangedAt = newState_us;
 
           if (onStateChangedCallback != NULL)
             onStateChangedCallback(state);
@@ -46,12 +64,12 @@ class PushButton
   private:
     uint8_t pin;
     unsigned int threshold_ms;
-    unsigned long newState_ms = 0;
+    clock_us_t newState_us = 0, stateChangedAt = 0;
     ButtonState state = ButtonState::Off, lastState = ButtonState::Off, newState = ButtonState::Off;
     ButtonStateCallback onStateChangedCallback = NULL;
 
     void setState(int value) {
-      log_d("PushButton @%d: value=%d", pin, value);
+      TRACE(TRACE_BUTTON_STATE, pin, value);
 
       lastState = state;
       state = value == 0 ? ButtonState::Off : ButtonState::On;
@@ -76,10 +94,24 @@ class ToggleButton {
       onStateChangedCallback = cb;
     }
 
-    void loop(unsigned long now) {
+    void setThreshold(unsigned int ms)
+    {
+      btn.setThreshold(ms);
+    }
+
+    clock_us_t getStateChangedAt()
+    {
+      return btn.getStateChangedAt();
+    }
+
+    void loop(clock_us_t now) {
       btn.loop(now);
     }
 
+    void loop(clock_us_t now, int s) {
+      btn.loop(now, s);
+    }
+
   private:
     PushButton btn;
     ButtonState state = ButtonState::Off;
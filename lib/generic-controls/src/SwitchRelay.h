@@ -3,6 +3,7 @@
 
 #include <Arduino.h>
 #include <functional>
+#include <Trace.h>
 
 typedef std::function<void()> SwitchRelayStateChangedCallback;
 
@@ -56,6 +57,7 @@ class SwitchRelayPin : public SwitchRelay {
     virtual void setState(SwitchState targetState) override {
       digitalWrite(pin, targetState == SwitchState::On ? onValue : offValue);
       state = targetState;
+      TRACE(TRACE_RELAY_STATE, pin, (uint8_t)state);
 
       notifyStateChanged();
     }
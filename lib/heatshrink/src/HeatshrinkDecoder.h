@@ -0,0 +1,137 @@
+#ifndef HEATSHRINK_DECODER_H
+#define HEATSHRINK_DECODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// Image container written by build/compress_firmware.py:
+//   "HSF1" | window bits (u8) | lookahead bits (u8) | reserved (u16) | original size (u32 LE) | MD5 of original (16) | stream
+#define HEATSHRINK_IMAGE_MAGIC        "HSF1"
+#define HEATSHRINK_IMAGE_HEADER_SIZE  28
+
+struct heatshrink_image_header_t {
+  uint8_t windowBits;
+  uint8_t lookaheadBits;
+  uint32_t size;
+  uint8_t md5[16];
+
+  bool parse(const uint8_t* buf) {
+    if (memcmp(buf, HEATSHRINK_IMAGE_MAGIC, 4) != 0) return false;
+
+    windowBits = buf[4];
+    lookaheadBits = buf[5];
+    size = (uint32_t)buf[8] | ((uint32_t)buf[9] << 8) | ((uint32_t)buf[10] << 16) | ((uint32_t)buf[11] << 24);
+    memcpy(md5, buf + 12, sizeof(md5));
+    return true;
+  }
+};
+
+// Streaming decoder for the heatshrink LZSS bitstream (compatible with `heatshrink -d -w W -l L`).
+// Memory use is fixed: a 2^MAX_WINDOW_BITS history window plus a small output buffer.
+template<uint8_t MAX_WINDOW_BITS = 10, size_t OUTPUT_BUFFER_SIZE = 256>
+class HeatshrinkDecoder {
+  public:
+    HeatshrinkDecoder() { }
+
+    // Returns false for parameters this instance can't decode
+    bool reset(uint8_t windowBits, uint8_t lookaheadBits, uint32_t outputLimit = UINT32_MAX) {
+      if (windowBits < 4 || windowBits > MAX_WINDOW_BITS || lookaheadBits < 3 || lookaheadBits >= windowBits) return false;
+
+      this->windowBits = windowBits;
+      this->lookaheadBits = lookaheadBits;
+      this->outputLimit = outputLimit;
+      mask = (1 << windowBits) - 1;
+      head = 0;
+      outputSize = 0;
+      outLength = 0;
+      beginToken(State::Tag, 1);
+      memset(window, 0, sizeof(window));
+      return true;
+    }
+
+    // Decodes the next piece of input; sink(const uint8_t*, size_t) returns false to abort
+    template<typename S>
+    bool decode(const uint8_t* input, size_t length, S sink) {
+      for (size_t i = 0; i < length && outputSize < outputLimit; i++) {
+        uint8_t byte = input[i];
+
+        for (int8_t bit = 7; bit >= 0 && outputSize < outputLimit; bit--) {
+          bits = (bits << 1) | ((byte >> bit) & 1);
+          if (--bitsLeft > 0) continue;
+
+          switch (state) {
+            case State::Tag:
+              if (bits) beginToken(State::Literal, 8);
+              else beginToken(State::Index, windowBits);
+              break;
+
+            case State::Literal:
+              if (!emit((uint8_t)bits, sink)) return false;
+              beginToken(State::Tag, 1);
+              break;
+
+            case State::Index:
+              offset = bits + 1;
+              beginToken(State::Count, lookaheadBits);
+              break;
+
+            case State::Count:
+              for (uint16_t n = bits + 1; n > 0 && outputSize < outputLimit; n--) {
+                if (!emit(window[(head - offset) & mask], sink)) return false;
+              }
+              beginToken(State::Tag, 1);
+              break;
+          }
+        }
+      }
+
+      return true;
+    }
+
+    // Hands any buffered output to the sink
+    template<typename S>
+    bool flush(S sink) {
+      if (outLength == 0) return true;
+
+      auto n = outLength;
+      outLength = 0;
+      return sink(out, n);
+    }
+
+    bool isComplete() {
+      return outputSize >= outputLimit;
+    }
+
+    uint32_t getOutputSize() {
+      return outputSize;
+    }
+
+  private:
+    enum class State : uint8_t { Tag, Literal, Index, Count };
+
+    uint8_t window[1 << MAX_WINDOW_BITS];
+    uint8_t out[OUTPUT_BUFFER_SIZE];
+    size_t outLength = 0;
+    uint8_t windowBits = MAX_WINDOW_BITS, lookaheadBits = 4, bitsLeft = 1;
+    uint16_t mask = 0, head = 0, offset = 0, bits = 0;
+    uint32_t outputSize = 0, outputLimit = UINT32_MAX;
+    State state = State::Tag;
+
+    void beginToken(State s, uint8_t width) {
+      state = s;
+      bitsLeft = width;
+      bits = 0;
+    }
+
+    template<typename S>
+    bool emit(uint8_t c, S sink) {
+      window[head++ & mask] = c;
+      out[outLength++] = c;
+      outputSize++;
+
+      return outLength < OUTPUT_BUFFER_SIZE || flush(sink);
+    }
+};
+
+#endif
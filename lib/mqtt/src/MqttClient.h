@@ -0,0 +1,607 @@
+#ifndef MQTT_CLIENT_H
+#define MQTT_CLIENT_H
+
+#include <Arduino.h>
+#include <Client.h>
+#include <IPAddress.h>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+#ifndef MQTTQOS0
+#define MQTTQOS0                      0
+#define MQTTQOS1                      1
+#endif
+
+#define MQTT_PROTOCOL_V311            4
+#define MQTT_PROTOCOL_V5              5
+
+#ifndef MQTT_CLIENT_BUFFER_SIZE
+#define MQTT_CLIENT_BUFFER_SIZE       256
+#endif
+
+#ifndef MQTT_CLIENT_KEEPALIVE_SEC
+#define MQTT_CLIENT_KEEPALIVE_SEC     15
+#endif
+
+#ifndef MQTT_CLIENT_SOCKET_TIMEOUT_SEC
+#define MQTT_CLIENT_SOCKET_TIMEOUT_SEC 15
+#endif
+
+#ifndef MQTT_CLIENT_V5_HANGUPS
+#define MQTT_CLIENT_V5_HANGUPS        2     // level 5 CONNECTs in a row the broker hung up on before trying 3.1.1
+#endif
+
+#ifndef MQTT_CLIENT_TOPIC_ALIAS_AFTER
+#define MQTT_CLIENT_TOPIC_ALIAS_AFTER 2     // publishes of a topic within a connection before it gets an alias
+#endif
+
+// state(), same values as PubSubClient
+#define MQTT_CONNECTION_TIMEOUT       -4
+#define MQTT_CONNECTION_LOST          -3
+#define MQTT_CONNECT_FAILED           -2
+#define MQTT_DISCONNECTED             -1
+#define MQTT_CONNECTED                0
+
+#define MQTT_PACKET_CONNECT           0x10
+#define MQTT_PACKET_CONNACK           0x20
+#define MQTT_PACKET_PUBLISH           0x30
+#define MQTT_PACKET_PUBACK            0x40
+#define MQTT_PACKET_SUBSCRIBE         0x80
+#define MQTT_PACKET_SUBACK            0x90
+#define MQTT_PACKET_PINGREQ           0xC0
+#define MQTT_PACKET_PINGRESP          0xD0
+#define MQTT_PACKET_DISCONNECT        0xE0
+
+#define MQTT_PROPERTY_SERVER_KEEP_ALIVE 0x13
+#define MQTT_PROPERTY_TOPIC_ALIAS_MAXIMUM 0x22
+#define MQTT_PROPERTY_TOPIC_ALIAS     0x23
+
+#define MQTT_MAX_HEADER_SIZE          5     // fixed header byte + up to 4 bytes remaining length
+
+// QoS 0 publisher / QoS 0-1 subscriber speaking MQTT 5 with a fallback to 3.1.1,
+// a drop-in for the part of PubSubClient that PubSub uses.
+//
+// On MQTT 5 connections, topics published more than once get a topic alias, so
+// repeated publishes carry a 2-byte alias instead of the full topic string. Aliases
+// are per connection and bounded by the broker's Topic Alias Maximum (CONNACK).
+// A broker that refuses protocol level 5 in its CONNACK is retried right away with
+// 3.1.1, which then sticks until restart. A broker that just hangs up on level 5 may
+// as well have dropped the connection for any other reason: only after
+// MQTT_CLIENT_V5_HANGUPS of those in a row is 3.1.1 tried, and level 5 again on the
+// next reconnect.
+class MqttClient {
+  public:
+    typedef std::function<void(char*, uint8_t*, unsigned int)> callback_t;
+
+    MqttClient(Client& client) : client(client) {
+      setBufferSize(MQTT_CLIENT_BUFFER_SIZE);
+    }
+
+    ~MqttClient() {
+      free(buffer);
+    }
+
+    MqttClient& setServer(const char* host, uint16_t port) {
+      serverHost = host;
+      serverPort = port;
+      return *this;
+    }
+
+    MqttClient& setServer(IPAddress address, uint16_t port) {
+      serverAddress = address;
+      serverHost = NULL;
+      serverPort = port;
+      return *this;
+    }
+
+    MqttClient& setCallback(callback_t cb) {
+      callback = cb;
+      return *this;
+    }
+
+    MqttClient& setKeepAlive(uint16_t sec) {
+      keepAliveSec = sec;
+      return *this;
+    }
+
+    // Protocol level tried first on connect, MQTT_PROTOCOL_V5 or MQTT_PROTOCOL_V311
+    MqttClient& setProtocolVersion(uint8_t version) {
+      protocolVersion = preferredVersion = version;
+      return *this;
+    }
+
+    // Client-side cap on aliases per connection, the broker's maximum still applies
+    MqttClient& setTopicAliasMaximum(uint16_t max) {
+      clientAliasMaximum = max;
+      return *this;
+    }
+
+    bool setBufferSize(uint16_t size) {
+      if (size <= MQTT_MAX_HEADER_SIZE) return false;
+
+      auto resized = (uint8_t*)realloc(buffer, size);
+      if (resized == NULL) return false;
+
+      buffer = resized;
+      bufferSize = size;
+      return true;
+    }
+
+    uint16_t getBufferSize() {
+      return bufferSize;
+    }
+
+    // Negotiated for the current connection
+    uint8_t getProtocolVersion() {
+      return protocolVersion;
+    }
+
+    // Keep alive in effect for the current connection, the broker may override setKeepAlive()
+    uint16_t getKeepAlive() {
+      return sessionKeepAliveSec;
+    }
+
+    uint16_t getTopicAliasCount() {
+      return nextAlias - 1;
+    }
+
+    unsigned long getBytesSent() {
+      return bytesSent;
+    }
+
+    unsigned long getBytesReceived() {
+      return bytesReceived;
+    }
+
+    int state() {
+      return connectionState;
+    }
+
+    bool connect(const char* id, const char* user, const char* pass, const char* willTopic, uint8_t willQos, bool willRetain, const char* willMessage, bool cleanSession = true) {
+      if (connected()) return true;
+
+      protocolVersion = protocolRejected ? MQTT_PROTOCOL_V311 : preferredVersion;
+      int result = connectOnce(id, user, pass, willTopic, willQos, willRetain, willMessage, cleanSession);
+
+      if (result == CONNECT_HANGUP && v5HangUps < MQTT_CLIENT_V5_HANGUPS) v5HangUps++;
+      else if (result == CONNECT_OK && protocolVersion == MQTT_PROTOCOL_V5) v5HangUps = 0;
+
+      // 3.1.1 brokers answer level 5 with "unacceptable protocol version", some just hang up
+      if (result == CONNECT_PROTOCOL_REJECTED || (result == CONNECT_HANGUP && v5HangUps >= MQTT_CLIENT_V5_HANGUPS)) {
+        client.stop();
+        protocolRejected = result == CONNECT_PROTOCOL_REJECTED;
+        protocolVersion = MQTT_PROTOCOL_V311;
+        result = connectOnce(id, user, pass, willTopic, willQos, willRetain, willMessage, cleanSession);
+      }
+
+      if (result != CONNECT_OK) {
+        client.stop();
+        return false;
+      }
+
+      return true;
+    }
+
+    bool connected() {
+      if (!client.connected()) {
+        if (connectionState == MQTT_CONNECTED) {
+          connectionState = MQTT_CONNECTION_LOST;
+          client.stop();
+        }
+        return false;
+      }
+
+      return connectionState == MQTT_CONNECTED;
+    }
+
+    void disconnect() {
+      buffer[0] = MQTT_PACKET_DISCONNECT;
+      buffer[1] = 0;
+      write(buffer, 2);
+
+      connectionState = MQTT_DISCONNECTED;
+      client.flush();
+      client.stop();
+      lastInActivity = lastOutActivity = millis();
+    }
+
+    bool loop() {
+      if (!connected()) return false;
+
+      unsigned long t = millis();
+      unsigned long keepAliveMs = sessionKeepAliveSec * 1000UL;
+
+      if (keepAliveMs > 0 && (t - lastInActivity > keepAliveMs || t - lastOutActivity > keepAliveMs)) {
+        if (pingOutstanding) {
+          connectionState = MQTT_CONNECTION_TIMEOUT;
+          client.stop();
+          return false;
+        }
+
+        buffer[0] = MQTT_PACKET_PINGREQ;
+        buffer[1] = 0;
+        write(buffer, 2);
+        lastInActivity = t;
+        pingOutstanding = true;
+      }
+
+      if (client.available() == 0) return true;
+
+      size_t length;
+      if (!readPacket(&length)) return connected();
+
+      lastInActivity = t;
+      switch (buffer[0] & 0xF0) {
+        case MQTT_PACKET_PUBLISH:
+          onPublish(length);
+          break;
+        case MQTT_PACKET_PINGREQ:
+          buffer[0] = MQTT_PACKET_PINGRESP;
+          buffer[1] = 0;
+          write(buffer, 2);
+          break;
+        case MQTT_PACKET_PINGRESP:
+          pingOutstanding = false;
+          break;
+        case MQTT_PACKET_DISCONNECT:
+          connectionState = MQTT_DISCONNECTED;
+          client.stop();
+          return false;
+      }
+
+      return true;
+    }
+
+    bool publish(const char* topic, const char* payload, bool retained = false) {
+      return publish(topic, (const uint8_t*)payload, payload ? strlen(payload) : 0, retained);
+    }
+
+    bool publish(const char* topic, const uint8_t* payload, unsigned int length, bool retained = false) {
+      if (!connected()) return false;
+
+      // Checked for the full topic plus alias, so an alias is only handed out when it gets sent
+      size_t topicLength = strlen(topic);
+      if (MQTT_MAX_HEADER_SIZE + 2 + topicLength + (protocolVersion == MQTT_PROTOCOL_V5 ? 4 : 0) + length > bufferSize) return false;
+
+      uint16_t alias = 0;
+      bool sendTopic = true;
+      if (protocolVersion == MQTT_PROTOCOL_V5) {
+        alias = topicAlias(topic, &sendTopic);
+      }
+
+      size_t properties = alias > 0 ? 3 : 0;
+
+      size_t pos = MQTT_MAX_HEADER_SIZE;
+      pos = writeString(sendTopic ? topic : "", sendTopic ? topicLength : 0, pos);
+
+      if (protocolVersion == MQTT_PROTOCOL_V5) {
+        buffer[pos++] = properties;
+        if (alias > 0) {
+          buffer[pos++] = MQTT_PROPERTY_TOPIC_ALIAS;
+          buffer[pos++] = alias >> 8;
+          buffer[pos++] = alias & 0xFF;
+        }
+      }
+
+      if (length > 0) memcpy(buffer + pos, payload, length);
+      pos += length;
+
+      return writePacket(MQTT_PACKET_PUBLISH | (retained ? 1 : 0), pos - MQTT_MAX_HEADER_SIZE);
+    }
+
+    bool subscribe(const char* topic, uint8_t qos = MQTTQOS0) {
+      if (!connected() || qos > MQTTQOS1) return false;
+
+      size_t topicLength = strlen(topic);
+      if (MQTT_MAX_HEADER_SIZE + 2 + 1 + 2 + topicLength + 1 > bufferSize) return false;
+
+      if (++nextPacketId == 0) nextPacketId = 1;
+
+      size_t pos = MQTT_MAX_HEADER_SIZE;
+      buffer[pos++] = nextPacketId >> 8;
+      buffer[pos++] = nextPacketId & 0xFF;
+      if (protocolVersion == MQTT_PROTOCOL_V5) buffer[pos++] = 0;  // no properties
+      pos = writeString(topic, topicLength, pos);
+      buffer[pos++] = qos;
+
+      return writePacket(MQTT_PACKET_SUBSCRIBE | 0x02, pos - MQTT_MAX_HEADER_SIZE);
+    }
+
+  private:
+    enum connect_result_t { CONNECT_OK, CONNECT_FAILED, CONNECT_PROTOCOL_REJECTED, CONNECT_HANGUP };
+
+    struct topic_alias_t {
+      uint16_t alias = 0;
+      uint8_t published = 0;
+    };
+
+    Client& client;
+    uint8_t* buffer = NULL;
+    uint16_t bufferSize = 0;
+    const char* serverHost = NULL;
+    IPAddress serverAddress;
+    uint16_t serverPort = 1883;
+    callback_t callback = NULL;
+
+    uint8_t protocolVersion = MQTT_PROTOCOL_V5, preferredVersion = MQTT_PROTOCOL_V5, v5HangUps = 0;
+    bool protocolRejected = false;
+    uint16_t keepAliveSec = MQTT_CLIENT_KEEPALIVE_SEC, sessionKeepAliveSec = MQTT_CLIENT_KEEPALIVE_SEC;
+    int connectionState = MQTT_DISCONNECTED;
+    unsigned long lastInActivity = 0, lastOutActivity = 0;
+    bool pingOutstanding = false;
+    uint16_t nextPacketId = 0;
+    unsigned long bytesSent = 0, bytesReceived = 0;
+
+    uint16_t clientAliasMaximum = 0xFFFF, aliasMaximum = 0, nextAlias = 1;
+    std::unordered_map<std::string, topic_alias_t> topicAliases;
+
+    int connectOnce(const char* id, const char* user, const char* pass, const char* willTopic, uint8_t willQos, bool willRetain, const char* willMessage, bool cleanSession) {
+      int result = serverHost != NULL ? client.connect(serverHost, serverPort) : client.connect(serverAddress, serverPort);
+      if (result != 1) {
+        connectionState = MQTT_CONNECT_FAILED;
+        return CONNECT_FAILED;
+      }
+
+      nextPacketId = 0;
+      sessionKeepAliveSec = keepAliveSec;
+      aliasMaximum = 0;
+      nextAlias = 1;
+      topicAliases.clear();
+
+      size_t pos = MQTT_MAX_HEADER_SIZE;
+      const uint8_t header[] = { 0x00, 0x04, 'M', 'Q', 'T', 'T', protocolVersion };
+      memcpy(buffer + pos, header, sizeof(header));
+      pos += sizeof(header);
+
+      uint8_t flags = cleanSession ? 0x02 : 0;
+      if (willTopic) flags |= 0x04 | (willQos << 3) | (willRetain ? 0x20 : 0);
+      if (user) flags |= 0x80 | (pass ? 0x40 : 0);
+
+      buffer[pos++] = flags;
+      buffer[pos++] = keepAliveSec >> 8;
+      buffer[pos++] = keepAliveSec & 0xFF;
+      if (protocolVersion == MQTT_PROTOCOL_V5) buffer[pos++] = 0;  // no properties
+
+      size_t needed = pos + 2 + strlen(id);
+      if (willTopic) needed += (protocolVersion == MQTT_PROTOCOL_V5 ? 1 : 0) + 2 + strlen(willTopic) + 2 + (willMessage ? strlen(willMessage) : 0);
+      if (user) needed += 2 + strlen(user) + (pass ? 2 + strlen(pass) : 0);
+      if (needed > bufferSize) {
+        connectionState = MQTT_CONNECT_FAILED;
+        return CONNECT_FAILED;
+      }
+
+      pos = writeString(id, strlen(id), pos);
+      if (willTopic) {
+        if (protocolVersion == MQTT_PROTOCOL_V5) buffer[pos++] = 0;  // no will properties
+        pos = writeString(willTopic, strlen(willTopic), pos);
+        pos = writeString(willMessage, willMessage ? strlen(willMessage) : 0, pos);
+      }
+      if (user) {
+        pos = writeString(user, strlen(user), pos);
+        if (pass) pos = writeString(pass, strlen(pass), pos);
+      }
+
+      if (!writePacket(MQTT_PACKET_CONNECT, pos - MQTT_MAX_HEADER_SIZE)) return CONNECT_FAILED;
+
+      size_t length;
+      if (!readPacket(&length)) {
+        if (connectionState == MQTT_CONNECTION_LOST && protocolVersion == MQTT_PROTOCOL_V5) return CONNECT_HANGUP;
+        return CONNECT_FAILED;
+      }
+
+      if ((buffer[0] & 0xF0) != MQTT_PACKET_CONNACK || length < 4) {
+        connectionState = MQTT_CONNECT_FAILED;
+        return CONNECT_FAILED;
+      }
+
+      uint8_t reasonCode = buffer[3];
+      if (reasonCode != 0) {
+        connectionState = reasonCode;
+        // 0x01: 3.1.1 "unacceptable protocol version", 0x84: 5.0 "unsupported protocol version"
+        return (reasonCode == 0x01 || reasonCode == 0x84) && protocolVersion == MQTT_PROTOCOL_V5 ? CONNECT_PROTOCOL_REJECTED : CONNECT_FAILED;
+      }
+
+      if (protocolVersion == MQTT_PROTOCOL_V5) {
+        parseConnackProperties(4, length);
+      }
+
+      lastInActivity = lastOutActivity = millis();
+      pingOutstanding = false;
+      connectionState = MQTT_CONNECTED;
+      return CONNECT_OK;
+    }
+
+    // Alias for a topic on this connection, 0 to send the topic only.
+    // sendTopic is false once the broker knows the mapping.
+    uint16_t topicAlias(const char* topic, bool* sendTopic) {
+      if (aliasMaximum == 0) return 0;
+
+      auto& entry = topicAliases[topic];
+      if (entry.alias > 0) {
+        *sendTopic = false;
+        return entry.alias;
+      }
+
+      if (entry.published < MQTT_CLIENT_TOPIC_ALIAS_AFTER) entry.published++;
+      if (entry.published < MQTT_CLIENT_TOPIC_ALIAS_AFTER || nextAlias > aliasMaximum) return 0;
+
+      // First aliased publish carries both topic and alias to establish the mapping
+      entry.alias = nextAlias++;
+      return entry.alias;
+    }
+
+    void parseConnackProperties(size_t pos, size_t length) {
+      uint32_t propertiesLength;
+      if (!readVarInt(&pos, length, &propertiesLength)) return;
+
+      size_t end = pos + propertiesLength;
+      if (end > length) end = length;
+
+      while (pos < end) {
+        uint8_t id = buffer[pos++];
+        size_t size;
+
+        switch (id) {
+          case 0x01: case 0x17: case 0x19: case 0x24: case 0x25: case 0x28: case 0x29: case 0x2A:
+            size = 1; break;
+          case 0x13: case 0x21: case 0x22: case 0x23:
+            size = 2; break;
+          case 0x02: case 0x11: case 0x18: case 0x27:
+            size = 4; break;
+          case 0x03: case 0x08: case 0x09: case 0x12: case 0x15: case 0x16: case 0x1A: case 0x1C: case 0x1F:
+            if (pos + 2 > end) return;
+            size = 2 + ((buffer[pos] << 8) | buffer[pos + 1]);
+            break;
+          case 0x26:
+            if (pos + 2 > end) return;
+            size = 2 + ((buffer[pos] << 8) | buffer[pos + 1]);
+            if (pos + size + 2 > end) return;
+            size += 2 + ((buffer[pos + size] << 8) | buffer[pos + size + 1]);
+            break;
+          default:
+            return;   // unknown property, can't skip it
+        }
+
+        if (pos + size > end) return;
+        if (id == MQTT_PROPERTY_TOPIC_ALIAS_MAXIMUM) {
+          uint16_t max = (buffer[pos] << 8) | buffer[pos + 1];
+          aliasMaximum = max < clientAliasMaximum ? max : clientAliasMaximum;
+        }
+        else if (id == MQTT_PROPERTY_SERVER_KEEP_ALIVE) {
+          sessionKeepAliveSec = (buffer[pos] << 8) | buffer[pos + 1];
+        }
+        pos += size;
+      }
+    }
+
+    void onPublish(size_t length) {
+      uint8_t qos = (buffer[0] >> 1) & 0x03;
+      size_t pos = 2;   // fixed header is always stored as 2 bytes, see readPacket
+      if (pos + 2 > length) return;
+
+      size_t topicLength = (buffer[pos] << 8) | buffer[pos + 1];
+      size_t topicPos = pos + 2;
+      pos = topicPos + topicLength;
+
+      uint16_t packetId = 0;
+      if (qos > 0) {
+        if (pos + 2 > length) return;
+        packetId = (buffer[pos] << 8) | buffer[pos + 1];
+        pos += 2;
+      }
+
+      if (protocolVersion == MQTT_PROTOCOL_V5) {
+        uint32_t propertiesLength;
+        if (!readVarInt(&pos, length, &propertiesLength)) return;
+        pos += propertiesLength;
+      }
+      if (pos > length) return;
+
+      // Null-terminate the topic in place by moving it one byte down over its length field
+      memmove(buffer + topicPos - 1, buffer + topicPos, topicLength);
+      buffer[topicPos - 1 + topicLength] = 0;
+
+      if (callback != NULL) {
+        callback((char*)buffer + topicPos - 1, buffer + pos, length - pos);
+      }
+
+      if (qos == MQTTQOS1) {
+        buffer[0] = MQTT_PACKET_PUBACK;
+        buffer[1] = 2;
+        buffer[2] = packetId >> 8;
+        buffer[3] = packetId & 0xFF;
+        write(buffer, 4);
+      }
+    }
+
+    bool readVarInt(size_t* pos, size_t length, uint32_t* value) {
+      *value = 0;
+      for (uint8_t shift = 0; shift < 28; shift += 7) {
+        if (*pos >= length) return false;
+
+        uint8_t b = buffer[(*pos)++];
+        *value |= (uint32_t)(b & 0x7F) << shift;
+        if ((b & 0x80) == 0) return true;
+      }
+      return false;
+    }
+
+    size_t writeString(const char* s, size_t length, size_t pos) {
+      buffer[pos++] = length >> 8;
+      buffer[pos++] = length & 0xFF;
+      if (length > 0) memcpy(buffer + pos, s, length);
+      return pos + length;
+    }
+
+    // Content sits at buffer + MQTT_MAX_HEADER_SIZE, the fixed header goes right in front of it
+    bool writePacket(uint8_t header, size_t length) {
+      uint8_t lengthBytes[4];
+      uint8_t n = 0;
+      size_t remaining = length;
+      do {
+        uint8_t b = remaining & 0x7F;
+        remaining >>= 7;
+        lengthBytes[n++] = remaining > 0 ? b | 0x80 : b;
+      } while (remaining > 0 && n < 4);
+
+      size_t start = MQTT_MAX_HEADER_SIZE - 1 - n;
+      buffer[start] = header;
+      memcpy(buffer + start + 1, lengthBytes, n);
+
+      return write(buffer + start, 1 + n + length);
+    }
+
+    bool write(const uint8_t* data, size_t length) {
+      size_t written = client.write(data, length);
+      bytesSent += written;
+      lastOutActivity = millis();
+      return written == length;
+    }
+
+    bool readByte(uint8_t* b) {
+      unsigned long start = millis();
+      while (!client.available()) {
+        if (millis() - start >= MQTT_CLIENT_SOCKET_TIMEOUT_SEC * 1000UL) {
+          connectionState = MQTT_CONNECTION_TIMEOUT;
+          return false;
+        }
+        if (!client.connected()) {
+          connectionState = MQTT_CONNECTION_LOST;
+          return false;
+        }
+        yield();
+      }
+
+      *b = client.read();
+      bytesReceived++;
+      return true;
+    }
+
+    // Reads one packet as [type byte][0][content...] (the remaining length is not kept);
+    // *length is the stored size. Packets larger than the buffer are consumed and dropped.
+    bool readPacket(size_t* length) {
+      uint8_t b;
+      if (!readByte(&b)) return false;
+      buffer[0] = b;
+
+      uint32_t remaining = 0;
+      for (uint8_t shift = 0; ; shift += 7) {
+        if (shift >= 28 || !readByte(&b)) return false;
+        remaining |= (uint32_t)(b & 0x7F) << shift;
+        if ((b & 0x80) == 0) break;
+      }
+      buffer[1] = 0;
+
+      bool fitsBuffer = remaining + 2 <= bufferSize;
+      for (uint32_t i = 0; i < remaining; i++) {
+        if (!readByte(&b)) return false;
+        if (fitsBuffer) buffer[2 + i] = b;
+      }
+
+      *length = 2 + remaining;
+      return fitsBuffer;
+    }
+};
+
+#endif
@@ -0,0 +1,3 @@
+#include "Trace.h"
+
+TraceRing traceRing;
@@ -0,0 +1,137 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <Clock.h>
+#include "TraceEvents.h"
+
+#ifndef TRACE_BUFFER_RECORDS
+#define TRACE_BUFFER_RECORDS          256   // power of two
+#endif
+
+#define TRACE_FRAME_MAGIC_0           'T'
+#define TRACE_FRAME_MAGIC_1           'R'
+#define TRACE_FRAME_VERSION           2
+#define TRACE_FRAME_HEADER_SIZE       8
+
+static_assert((TRACE_BUFFER_RECORDS & (TRACE_BUFFER_RECORDS - 1)) == 0, "TRACE_BUFFER_RECORDS must be a power of two");
+
+// Fixed-size binary trace record, little endian on the wire. The timestamp is clock_now() in 48 bits
+// (wraps after ~8.9 years of uptime), split around the id to keep the record at 16 bytes.
+struct trace_record_t {
+  uint32_t timestamp;                     // clock_now(), bits 0..31
+  uint16_t id;                            // trace_event_t
+  uint16_t timestampHigh;                 // clock_now(), bits 32..47
+  uint32_t args[2];
+};
+
+static_assert(sizeof(trace_record_t) == 16, "trace_record_t must stay 16 bytes, the host decoder relies on it");
+
+// Bounded lock-free multi-producer/single-consumer ring (per-slot sequence numbers).
+// record() is safe from any task or ISR and never blocks: when the ring is full the
+// record is counted as dropped. drain() is called from one place only (loop idle time).
+class TraceRing {
+  public:
+    TraceRing() {
+      for (uint32_t i = 0; i < TRACE_BUFFER_RECORDS; i++) {
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+      }
+    }
+
+    bool IRAM_ATTR record(uint16_t id, uint32_t arg0 = 0, uint32_t arg1 = 0) {
+      uint32_t pos = enqueuePos.load(std::memory_order_relaxed);
+
+      for (;;) {
+        auto& slot = slots[pos & (TRACE_BUFFER_RECORDS - 1)];
+        int32_t diff = (int32_t)(slot.sequence.load(std::memory_order_acquire) - pos);
+
+        if (diff == 0) {
+          if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+            clock_us_t now = clock_now();
+            slot.record.timestamp = (uint32_t)now;
+            slot.record.id = id;
+            slot.record.timestampHigh = (uint16_t)(now >> 32);
+            slot.record.args[0] = arg0;
+            slot.record.args[1] = arg1;
+            slot.sequence.store(pos + 1, std::memory_order_release);
+            return true;
+          }
+        }
+        else if (diff < 0) {
+          dropped.fetch_add(1, std::memory_order_relaxed);
+          return false;
+        }
+        else {
+          pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    // Copies up to `max` committed records out, oldest first
+    size_t drain(trace_record_t* out, size_t max) {
+      size_t n = 0;
+
+      while (n < max) {
+        auto& slot = slots[dequeuePos & (TRACE_BUFFER_RECORDS - 1)];
+        if ((int32_t)(slot.sequence.load(std::memory_order_acquire) - (dequeuePos + 1)) < 0) break;
+
+        out[n++] = slot.record;
+        slot.sequence.store(dequeuePos + TRACE_BUFFER_RECORDS, std::memory_order_release);
+        dequeuePos++;
+      }
+
+      return n;
+    }
+
+    // Drains into a frame: "TR" | version | count | dropped total (u32) | count x trace_record_t
+    size_t drainFrame(uint8_t* frame, size_t size) {
+      if (size < TRACE_FRAME_HEADER_SIZE + sizeof(trace_record_t)) return 0;
+
+      size_t max = (size - TRACE_FRAME_HEADER_SIZE) / sizeof(trace_record_t);
+      if (max > 255) max = 255;
+
+      // record by record: frame + header isn't necessarily aligned for trace_record_t
+      size_t count = 0;
+      trace_record_t record;
+      while (count < max && drain(&record, 1) == 1) {
+        memcpy(frame + TRACE_FRAME_HEADER_SIZE + count * sizeof(record), &record, sizeof(record));
+        count++;
+      }
+      if (count == 0) return 0;
+
+      uint32_t droppedTotal = dropped.load(std::memory_order_relaxed);
+      frame[0] = TRACE_FRAME_MAGIC_0;
+      frame[1] = TRACE_FRAME_MAGIC_1;
+      frame[2] = TRACE_FRAME_VERSION;
+      frame[3] = (uint8_t)count;
+      memcpy(frame + 4, &droppedTotal, sizeof(droppedTotal));
+
+      return TRACE_FRAME_HEADER_SIZE + count * sizeof(trace_record_t);
+    }
+
+    uint32_t getDropped() {
+      return dropped.load(std::memory_order_relaxed);
+    }
+
+  private:
+    struct slot_t {
+      std::atomic<uint32_t> sequence;
+      trace_record_t record;
+    };
+
+    slot_t slots[TRACE_BUFFER_RECORDS];
+    std::atomic<uint32_t> enqueuePos { 0 };
+    std::atomic<uint32_t> dropped { 0 };
+    uint32_t dequeuePos = 0;
+};
+
+extern TraceRing traceRing;
+
+#ifdef TRACE_DISABLED
+#define TRACE(id, ...)                do { } while (0)
+#else
+#define TRACE(id, ...)                traceRing.record((id), ##__VA_ARGS__)
+#endif
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef TRACE_EVENTS_H
+#define TRACE_EVENTS_H
+
+#include <stdint.h>
+
+// Trace event registry: X(name, id, format). tools/trace_decode.py reads this file
+// to turn records back into text, so keep one event per line.
+#define TRACE_EVENTS(X) \
+  X(TRACE_BUTTON_STATE,         1,  "button pin=%u value=%u") \
+  X(TRACE_BLINDS_STATE,         2,  "blinds state %u -> %u") \
+  X(TRACE_BLINDS_OBSTRUCTED,    3,  "blinds obstructed after %u ms (limit %u ms)") \
+  X(TRACE_RELAY_STATE,          4,  "relay pin=%u state=%u") \
+  X(TRACE_MQTT_MESSAGE,         5,  "mqtt message length=%u subscriptions=%u") \
+  X(TRACE_MQTT_DROPPED,         6,  "mqtt message dropped, total=%u coalesced=%u") \
+  X(TRACE_MQTT_CONNECT,         7,  "mqtt connect ok=%u attempt=%u")
+
+#define TRACE_EVENT_ENUM(name, id, format) name = id,
+
+enum trace_event_t : uint16_t {
+  TRACE_EVENTS(TRACE_EVENT_ENUM)
+};
+
+#undef TRACE_EVENT_ENUM
+
+#endif
@@ -12,6 +12,16 @@
 
 #define WIFI_RECONNECT_MILLIS         10000
 #define WIFI_WATCHDOG_MILLIS          60000
+#define WIFI_FAST_CONNECT_TIMEOUT_MILLIS  3000
+
+#define NTP_SERVER                    "pool.ntp.org"
+
+#ifndef POWER_MODE
+#define POWER_MODE                    1   // see POWER_MODE_* in power.h
+#endif
+#define WIFI_LISTEN_INTERVAL          3   // DTIM beacons between wake-ups in modem sleep
+#define POWER_IDLE_MAX_MILLIS         50  // upper bound on loop idle time (adds to command latency)
+#define POWER_STATS_MILLIS            60000
 
 #ifndef WIFI_HOSTNAME
 #define WIFI_HOSTNAME                 "roller-02"
@@ -20,6 +30,30 @@
 #define MQTT_SERVER_PORT              1883
 #define MQTT_RECONNECT_MILLIS         5000
 #define MQTT_QUEUE_MAX_SIZE           100
+#define MQTT_MAX_PACKETS_PER_LOOP     8
+#define MQTT_PROTOCOL_VERSION         MQTT_PROTOCOL_V5  // falls back to 3.1.1 when the broker refuses it
+#define MQTT_TOPIC_ALIAS_MAX          16
+#define MQTT_COMMAND_BURST            2     // per-topic token bucket for */state/set commands
+#define MQTT_COMMAND_REFILL_MILLIS    1000
+
+#define TELEMETRY_INTERVAL_MILLIS     60000
+#define TELEMETRY_BUFFER_SIZE         384
+
+#define TRACE_OUTPUT_NONE             0
+#define TRACE_OUTPUT_SERIAL           1
+#define TRACE_OUTPUT_MQTT             2
+
+#ifndef TRACE_OUTPUT
+#ifdef DEBUG
+#define TRACE_OUTPUT                  TRACE_OUTPUT_SERIAL
+#else
+#define TRACE_OUTPUT                  TRACE_OUTPUT_MQTT
+#endif
+#endif
+
+#define TRACE_SERIAL_BAUD             115200
+#define TRACE_FLUSH_MILLIS            1000  // MQTT output: one frame per interval at most
+#define TRACE_FRAME_RECORDS           32
 
 #ifndef MQTT_CLIENT_ID
 #define MQTT_CLIENT_ID                WIFI_HOSTNAME
@@ -28,12 +62,18 @@
 #define MQTT_PATH_PREFIX              "dev/" MQTT_CLIENT_ID
 #define MQTT_STATUS_TOPIC             MQTT_PATH_PREFIX "/status"
 #define MQTT_VERSION_TOPIC            MQTT_PATH_PREFIX "/version"
-// #define MQTT_CONFIG_TOPIC             MQTT_PATH_PREFIX "/config"
+#define MQTT_CONFIG_TOPIC             MQTT_PATH_PREFIX "/config"
 
 #define MQTT_STATUS_ONLINE_MSG        "online"
 #define MQTT_STATUS_OFFLINE_MSG       "offline"
 
 #define OTA_UPDATE_TIMEOUT_MILLIS     5*60000
+#define OTA_HTTP_BUFFER_SIZE          1024
+#define OTA_HTTP_WINDOW_BITS          10  // must be >= window bits of the compressed image
+#define OTA_MQTT_MAX_CHUNK_SIZE       1024
+#define OTA_MQTT_PROGRESS_MILLIS      5000
+
+#define MQTT_BUFFER_SIZE              (OTA_MQTT_MAX_CHUNK_SIZE + 128)
 
 #define WDT_TIMEOUT_SEC               20
 
@@ -46,6 +86,8 @@
 #define BUTTON_1_LED_PIN              INT_LED_PIN
 
 #define BLINDS_ROLLING_TIMELIMIT_MS   90000
+#define BLINDS_EDGE_POLL_MILLIS       50
+#define BUTTON_DEBOUNCE_MILLIS        100
 
 extern bool parseBooleanMessage(byte* payload, unsigned int length, boolean defaultValue = false);
 
@@ -0,0 +1,356 @@
+#ifndef __CHANNELS_H
+#define __CHANNELS_H
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <ArduinoJson.h>
+#include <soc/gpio_reg.h>
+#include <SwitchRelay.h>
+#include <BlindsController.h>
+#include <PushButton.h>
+#include <Clock.h>
+#include "app.h"
+#include "pubsub.h"
+#include "power.h"
+#include "config.h"
+
+#define CHANNEL_NAME_MAX_LENGTH       9   // NVS keys are "<name>_state", max 15 chars
+
+struct blinds_channel_t {
+  const char* name;
+  uint8_t powerPin, directionPin, edgeDetectorPin;
+};
+
+struct relay_channel_t {
+  const char* name;
+  uint8_t pin;
+  int8_t ledPin;                          // -1: no indicator LED
+  bool inverted;                          // published state is the inverse of the relay state
+};
+
+struct button_channel_t {
+  const char* name;
+  uint8_t pin;
+  int8_t relay;                           // index into RELAY_CHANNELS toggled by the button, -1: none
+};
+
+// Device layout. Topics are <prefix>/<name>/state, <prefix>/<name>/state/set and
+// <prefix>/<name>/event (timestamped changes), persisted state lives under the "<name>_state" key.
+constexpr blinds_channel_t BLINDS_CHANNELS[] = {
+  { "blinds", RELAY_BLINDS_POWER_PIN, RELAY_BLINDS_DIRECTION_PIN, REEDSWITCH_1_PIN },
+};
+
+constexpr relay_channel_t RELAY_CHANNELS[] = {
+  { "audio", RELAY_AUDIO_PIN, BUTTON_1_LED_PIN, true },
+};
+
+constexpr button_channel_t BUTTON_CHANNELS[] = {
+  { "button_1", BUTTON_1_PIN, 0 },
+};
+
+template<typename T, size_t N>
+constexpr size_t channel_count(const T (&)[N]) {
+  return N;
+}
+
+constexpr size_t channel_name_length(const char* name) {
+  return *name ? 1 + channel_name_length(name + 1) : 0;
+}
+
+template<typename T, size_t N>
+constexpr bool channel_names_fit(const T (&table)[N], size_t i = 0) {
+  return i >= N || (channel_name_length(table[i].name) <= CHANNEL_NAME_MAX_LENGTH && channel_names_fit(table, i + 1));
+}
+
+template<size_t N>
+constexpr bool button_relays_valid(const button_channel_t (&table)[N], size_t i = 0) {
+  return i >= N || (table[i].relay < (int)channel_count(RELAY_CHANNELS) && button_relays_valid(table, i + 1));
+}
+
+static_assert(channel_names_fit(BLINDS_CHANNELS) && channel_names_fit(RELAY_CHANNELS) && channel_names_fit(BUTTON_CHANNELS), "Channel name too long for its NVS key");
+static_assert(button_relays_valid(BUTTON_CHANNELS), "Button bound to a relay channel that doesn't exist");
+
+// Levels of all GPIOs in two register reads
+inline uint64_t read_gpio_levels() {
+  return REG_READ(GPIO_IN_REG) | ((uint64_t)REG_READ(GPIO_IN1_REG) << 32);
+}
+
+#define GPIO_LEVEL(levels, pin)       ((int)(((levels) >> (pin)) & 1))
+
+// Instantiates the controllers for the channel tables above and wires up their
+// topics and persistence. Inbound commands reach their channel through the
+// PubSub topic index (no per-channel scan), inputs are sampled once per loop.
+template<size_t BLINDS_COUNT, size_t RELAY_COUNT, size_t BUTTON_COUNT>
+class ChannelSet {
+  public:
+    ChannelSet(PubSub& pubsub, Preferences& preferences, PowerManager& power)
+      : pubsub(pubsub), preferences(preferences), power(power)
+    { }
+
+    // Call after preferences.begin(): restores persisted states
+    void begin() {
+      for (size_t i = 0; i < BLINDS_COUNT; i++) {
+        auto& c = BLINDS_CHANNELS[i];
+        auto& b = blinds[i];
+        initTopics(c.name, b.stateTopic, b.key, b.eventTopic);
+
+        b.controller = new AcMotorBlindsController(SwitchRelayPin(c.powerPin, (uint8_t)0), SwitchRelayPin(c.directionPin, (uint8_t)0), c.edgeDetectorPin, (BlindsState)preferences.getUChar(b.key.c_str()));
+        b.controller->onBlindsStateChanged([this, i]() { onBlindsStateChanged(i); });
+
+        b.travelTopic = MQTT_PATH_PREFIX "/";
+        b.travelTopic.concat(c.name);
+        b.travelTopic.concat("/travel");
+        b.travelKey = c.name;
+        b.travelKey.concat("_trv");
+
+        BlindsTravelStats travel[2];
+        if (preferences.getBytes(b.travelKey.c_str(), travel, sizeof(travel)) == sizeof(travel)) {
+          b.controller->setTravelStats(BlindsDirection::Up, travel[0]);
+          b.controller->setTravelStats(BlindsDirection::Down, travel[1]);
+        }
+        b.controller->onTravelStatsChanged([this, i](BlindsDirection d) { onTravelStatsChanged(i); });
+
+        subscribeSet(b.stateTopic, [this, i](uint8_t* p, unsigned int l) { onBlindsStateSet(i, p, l); }, isBlindsStop);
+        power.wakeOnPin(c.edgeDetectorPin);
+      }
+
+      for (size_t i = 0; i < RELAY_COUNT; i++) {
+        auto& c = RELAY_CHANNELS[i];
+        auto& r = relays[i];
+        initTopics(c.name, r.stateTopic, r.key, r.eventTopic);
+
+        if (c.ledPin >= 0) pinMode(c.ledPin, OUTPUT);
+
+        r.relay = new SwitchRelayPin(c.pin, (SwitchState)preferences.getUChar(r.key.c_str()));
+        r.relay->onStateChanged([this, i]() { onRelayStateChanged(i); });
+        if (c.ledPin >= 0) digitalWrite(c.ledPin, isRelayOn(i) ? 1 : 0);
+
+        subscribeSet(r.stateTopic, [this, i](uint8_t* p, unsigned int l) { onRelayStateSet(i, p, l); });
+      }
+
+      for (size_t i = 0; i < BUTTON_COUNT; i++) {
+        auto& c = BUTTON_CHANNELS[i];
+        auto& b = buttons[i];
+        initTopics(c.name, b.stateTopic, b.key, b.eventTopic);
+
+        b.button = new ToggleButton(c.pin, BUTTON_DEBOUNCE_MILLIS, INPUT_PULLUP, (ButtonState)preferences.getUChar(b.key.c_str()));
+        b.button->onButtonStateChanged([this, i](ButtonState s) { onButtonStateChanged(i, s); });
+
+        power.wakeOnPin(c.pin);
+      }
+    }
+
+    // One pass over all inputs from a single sample of the GPIO registers
+    void loop(clock_us_t now) {
+      auto levels = read_gpio_levels();
+
+      for (size_t i = 0; i < BLINDS_COUNT; i++) {
+        blinds[i].controller->loop(now, GPIO_LEVEL(levels, BLINDS_CHANNELS[i].edgeDetectorPin));
+      }
+
+      for (size_t i = 0; i < BUTTON_COUNT; i++) {
+        buttons[i].button->loop(now, GPIO_LEVEL(levels, BUTTON_CHANNELS[i].pin));
+      }
+    }
+
+    bool publishStates() {
+      bool result = true;
+
+      for (size_t i = 0; i < BUTTON_COUNT; i++) {
+        result &= pubsub.publish(buttons[i].stateTopic.c_str(), buttons[i].button->getState() == ButtonState::On ? "1" : "0", true);
+      }
+
+      for (size_t i = 0; i < BLINDS_COUNT; i++) {
+        result &= pubsub.publish(blinds[i].stateTopic.c_str(), blinds[i].controller->getStateString().c_str(), true);
+        result &= publishTravelStats(i);
+      }
+
+      for (size_t i = 0; i < RELAY_COUNT; i++) {
+        result &= pubsub.publish(relays[i].stateTopic.c_str(), isRelayOn(i) ? "1" : "0", true);
+      }
+
+      return result;
+    }
+
+    void applyConfig(const runtime_config_t& config) {
+      for (size_t i = 0; i < BLINDS_COUNT; i++) {
+        blinds[i].controller->setRollingTimeLimit(config.blindsRollingTimeLimitMs);
+        blinds[i].controller->setPollInterval(config.blindsEdgePollMs);
+      }
+
+      for (size_t i = 0; i < BUTTON_COUNT; i++) {
+        buttons[i].button->setThreshold(config.buttonDebounceMs);
+      }
+    }
+
+    // Back to the fixed time limit until the travel times are learned again
+    void resetTravelStats() {
+      for (size_t i = 0; i < BLINDS_COUNT; i++) {
+        blinds[i].controller->resetTravelStats();
+        preferences.remove(blinds[i].travelKey.c_str());
+        publishTravelStats(i);
+      }
+    }
+
+    bool isRolling() {
+      for (size_t i = 0; i < BLINDS_COUNT; i++) {
+        auto state = blinds[i].controller->getState();
+        if (state == BlindsState::RollingUp || state == BlindsState::RollingDown) return true;
+      }
+
+      return false;
+    }
+
+  private:
+    struct blinds_t {
+      AcMotorBlindsController* controller = NULL;
+      String stateTopic, key, eventTopic, travelTopic, travelKey;
+    };
+
+    struct relay_t {
+      SwitchRelayPin* relay = NULL;
+      String stateTopic, key, eventTopic;
+    };
+
+    struct button_t {
+      ToggleButton* button = NULL;
+      String stateTopic, key, eventTopic;
+    };
+
+    PubSub& pubsub;
+    Preferences& preferences;
+    PowerManager& power;
+    blinds_t blinds[BLINDS_COUNT];
+    relay_t relays[RELAY_COUNT];
+    button_t buttons[BUTTON_COUNT];
+
+    static void initTopics(const char* name, String& stateTopic, String& key, String& eventTopic) {
+      stateTopic = MQTT_PATH_PREFIX "/";
+      stateTopic.concat(name);
+
+      eventTopic = stateTopic;
+      eventTopic.concat("/event");
+      stateTopic.concat("/state");
+
+      key = name;
+      key.concat("_state");
+    }
+
+    void subscribeSet(const String& stateTopic, PubSub::message_handler_t handler, std::function<bool(const uint8_t*, unsigned int)> bypass = NULL) {
+      String topic(stateTopic);
+      topic.concat("/set");
+      pubsub.subscribe(topic.c_str(), MQTTQOS0, handler, PubSub::rate_limit_t { MQTT_COMMAND_BURST, MQTT_COMMAND_REFILL_MILLIS, true, bypass });
+    }
+
+    // Stop is never held back by the rate limit, and cancels a held up/down
+    static bool isBlindsStop(const uint8_t* payload, unsigned int length) {
+      return length > 0 && payload[0] == 's';
+    }
+
+    bool isRelayOn(size_t i) {
+      return (relays[i].relay->getState() == SwitchState::On) != RELAY_CHANNELS[i].inverted;
+    }
+
+    void onBlindsStateSet(size_t i, uint8_t* payload, unsigned int length) {
+      if (length == 0) return;
+      power.commandReceived();
+
+      auto controller = blinds[i].controller;
+      if (payload[0] == 'u') {
+        controller->pushUp();
+      }
+      else if (payload[0] == 'd') {
+        controller->pushDown();
+      }
+      else if (payload[0] == 's') {
+        controller->stop();
+      }
+    }
+
+    void onBlindsStateChanged(size_t i) {
+      auto& b = blinds[i];
+      auto state = b.controller->getStateString();
+
+      preferences.putUChar(b.key.c_str(), (uint8_t)b.controller->getState());
+      pubsub.publish(b.stateTopic.c_str(), state.c_str(), true);
+      publishEvent(b.eventTopic, state.c_str(), b.controller->getStateChangedAt());
+    }
+
+    void onTravelStatsChanged(size_t i) {
+      auto& b = blinds[i];
+      BlindsTravelStats travel[2] = { b.controller->getTravelStats(BlindsDirection::Up), b.controller->getTravelStats(BlindsDirection::Down) };
+
+      preferences.putBytes(b.travelKey.c_str(), travel, sizeof(travel));
+      publishTravelStats(i);
+    }
+
+    // {"up":{"mean_ms":..,"sigma_ms":..,"samples":..,"limit_ms":..},"down":{..}}
+    bool publishTravelStats(size_t i) {
+      auto controller = blinds[i].controller;
+
+      StaticJsonDocument<256> doc;
+      for (uint8_t d = 0; d < 2; d++) {
+        auto direction = (BlindsDirection)d;
+        auto stats = controller->getTravelStats(direction);
+
+        auto model = doc[d == 0 ? "up" : "down"];
+        model["mean_ms"] = (unsigned long)stats.meanMs;
+        model["sigma_ms"] = (unsigned long)sqrtf(stats.varianceMs2);
+        model["samples"] = stats.samples;
+        model["limit_ms"] = controller->getRollingLimit(direction);
+      }
+
+      char payload[192];
+      serializeJson(doc, payload, sizeof(payload));
+      return pubsub.publish(blinds[i].travelTopic.c_str(), payload, true);
+    }
+
+    void onRelayStateSet(size_t i, uint8_t* payload, unsigned int length) {
+      if (length == 0) return;
+      power.commandReceived();
+
+      if (parseBooleanMessage(payload, length)) relays[i].relay->setOn();
+      else relays[i].relay->setOff();
+    }
+
+    void onRelayStateChanged(size_t i) {
+      auto& r = relays[i];
+      bool on = isRelayOn(i);
+      auto changedAt = clock_now();
+
+      if (RELAY_CHANNELS[i].ledPin >= 0) digitalWrite(RELAY_CHANNELS[i].ledPin, on ? 1 : 0);
+      pubsub.publish(r.stateTopic.c_str(), on ? "1" : "0", true);
+      publishEvent(r.eventTopic, on ? "1" : "0", changedAt);
+      preferences.putUChar(r.key.c_str(), (uint8_t)r.relay->getState());
+    }
+
+    void onButtonStateChanged(size_t i, ButtonState state) {
+      auto relay = BUTTON_CHANNELS[i].relay;
+      if (relay >= 0) {
+        if (state == ButtonState::On) relays[relay].relay->setOn();
+        else relays[relay].relay->setOff();
+      }
+
+      preferences.putUChar(buttons[i].key.c_str(), (uint8_t)state);
+      pubsub.publish(buttons[i].stateTopic.c_str(), state == ButtonState::On ? "1" : "0");
+      publishEvent(buttons[i].eventTopic, state == ButtonState::On ? "1" : "0", buttons[i].button->getStateChangedAt());
+    }
+
+    // {"state":"FullUp","up_us":..,"ts_us":..}: when the change was captured, monotonic since boot and,
+    // once SNTP has synced, as Unix epoch - consumers subtract ts_us from their receive time for latency
+    void publishEvent(const String& eventTopic, const char* state, clock_us_t capturedAt) {
+      StaticJsonDocument<128> doc;
+      doc["state"] = state;
+      doc["up_us"] = (uint64_t)capturedAt;
+      auto epochUs = clock_to_epoch_us(capturedAt);
+      if (epochUs > 0) doc["ts_us"] = (int64_t)epochUs;
+
+      char event[96];
+      serializeJson(doc, event, sizeof(event));
+      pubsub.publish(eventTopic.c_str(), event);
+    }
+};
+
+typedef ChannelSet<channel_count(BLINDS_CHANNELS), channel_count(RELAY_CHANNELS), channel_count(BUTTON_CHANNELS)> Channels;
+
+#endif
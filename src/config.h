@@ -0,0 +1,130 @@
+#ifndef __CONFIG_H
+#define __CONFIG_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <Preferences.h>
+#include "app.h"
+#include "pubsub.h"
+
+#define CONFIG_VERSION                1
+#define CONFIG_PREFS_KEY              "config"
+
+struct runtime_config_t {
+  uint16_t version;
+  uint32_t revision;
+  uint32_t blindsRollingTimeLimitMs;
+  uint32_t blindsEdgePollMs;
+  uint32_t buttonDebounceMs;
+  uint32_t mqttReconnectMs;
+  uint32_t wifiReconnectMs;
+};
+
+typedef std::function<void(const runtime_config_t&)> config_apply_callback_t;
+typedef std::function<void()> config_action_callback_t;
+
+// Tuning parameters that can be changed at runtime through MQTT_CONFIG_TOPIC.
+// Payload is JSON, e.g. {"version":1,"revision":7,"blinds_timelimit_ms":40000};
+// omitted fields keep their current value. A revision above the applied one is validated as a whole,
+// persisted to NVS and handed to the apply callback - no restart involved.
+// "reset_travel":true additionally drops the learned blinds travel model, once per revision.
+class RuntimeConfig {
+  public:
+    RuntimeConfig(PubSub& pubsub, Preferences& preferences) : pubsub(pubsub), preferences(preferences) {
+      config = defaults();
+    }
+
+    void onApply(config_apply_callback_t cb) {
+      applyCallback = cb;
+    }
+
+    void onResetTravel(config_action_callback_t cb) {
+      resetTravelCallback = cb;
+    }
+
+    // Restores the persisted configuration (falls back to compile-time defaults) and applies it
+    void begin() {
+      runtime_config_t stored;
+      if (preferences.getBytes(CONFIG_PREFS_KEY, &stored, sizeof(stored)) == sizeof(stored)
+        && stored.version == CONFIG_VERSION && validate(stored) == NULL) {
+        config = stored;
+      }
+
+      apply();
+    }
+
+    const runtime_config_t& get() {
+      return config;
+    }
+
+    void onMessage(uint8_t* payload, unsigned int length) {
+      StaticJsonDocument<384> doc;
+      if (deserializeJson(doc, payload, length)) return reject("bad_json");
+      if ((uint16_t)(doc["version"] | 0) != CONFIG_VERSION) return reject("bad_version");
+
+      uint32_t revision = doc["revision"] | 0;
+      // stale or replayed (the retained copy after a reconnect); the retained status keeps the applied revision
+      if (revision <= config.revision) return reject("revision");
+
+      runtime_config_t next = config;
+      next.revision = revision;
+      next.blindsRollingTimeLimitMs = doc["blinds_timelimit_ms"] | next.blindsRollingTimeLimitMs;
+      next.blindsEdgePollMs = doc["blinds_poll_ms"] | next.blindsEdgePollMs;
+      next.buttonDebounceMs = doc["debounce_ms"] | next.buttonDebounceMs;
+      next.mqttReconnectMs = doc["mqtt_reconnect_ms"] | next.mqttReconnectMs;
+      next.wifiReconnectMs = doc["wifi_reconnect_ms"] | next.wifiReconnectMs;
+
+      auto error = validate(next);
+      if (error != NULL) return reject(error);
+
+      config = next;
+      preferences.putBytes(CONFIG_PREFS_KEY, &config, sizeof(config));
+      apply();
+      if ((doc["reset_travel"] | false) && resetTravelCallback != NULL) resetTravelCallback();
+
+      pubsub.publish(MQTT_CONFIG_TOPIC "/status", String(config.revision).c_str(), true);
+    }
+
+  private:
+    PubSub& pubsub;
+    Preferences& preferences;
+    runtime_config_t config;
+    config_apply_callback_t applyCallback = NULL;
+    config_action_callback_t resetTravelCallback = NULL;
+
+    static runtime_config_t defaults() {
+      runtime_config_t c;
+      memset(&c, 0, sizeof(c));
+      c.version = CONFIG_VERSION;
+      c.revision = 0;
+      c.blindsRollingTimeLimitMs = BLINDS_ROLLING_TIMELIMIT_MS;
+      c.blindsEdgePollMs = BLINDS_EDGE_POLL_MILLIS;
+      c.buttonDebounceMs = BUTTON_DEBOUNCE_MILLIS;
+      c.mqttReconnectMs = MQTT_RECONNECT_MILLIS;
+      c.wifiReconnectMs = WIFI_RECONNECT_MILLIS;
+      return c;
+    }
+
+    // Returns the name of the first out-of-range field, NULL if valid
+    static const char* validate(const runtime_config_t& c) {
+      if (c.blindsRollingTimeLimitMs < 5000 || c.blindsRollingTimeLimitMs > 600000) return "blinds_timelimit_ms";
+      if (c.blindsEdgePollMs < 10 || c.blindsEdgePollMs > 1000) return "blinds_poll_ms";
+      if (c.buttonDebounceMs < 10 || c.buttonDebounceMs > 2000) return "debounce_ms";
+      if (c.mqttReconnectMs < 1000 || c.mqttReconnectMs > 600000) return "mqtt_reconnect_ms";
+      if (c.wifiReconnectMs < 1000 || c.wifiReconnectMs >= WIFI_WATCHDOG_MILLIS) return "wifi_reconnect_ms";
+      return NULL;
+    }
+
+    void apply() {
+      if (applyCallback != NULL)
+        applyCallback(config);
+    }
+
+    void reject(const char* reason) {
+      String status("rejected:");
+      status.concat(reason);
+      pubsub.publish(MQTT_CONFIG_TOPIC "/status", status.c_str());
+    }
+};
+
+#endif
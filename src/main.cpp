@@ -2,25 +2,33 @@
 #include <rom/rtc.h>
 #include <esp_task_wdt.h>
 #include <WiFi.h>
-#include <PubSubClient.h>
-#include <SwitchRelay.h>
-#include <BlindsController.h>
 #include "pubsub.h"
 #include "reset_info.h"
+#include "power.h"
+#include "wifi_cache.h"
+#include "ota_http.h"
+#include "ota_mqtt.h"
+#include "telemetry.h"
+#include "config.h"
+#include "channels.h"
+#include "trace_output.h"
 #include <ArduinoOTA.h>
-#include <PushButton.h>
 #include <Preferences.h>
+#include <Clock.h>
 
 RESET_REASON
   reset_reason[2];
 
-unsigned long 
+clock_us_t
   now = 0,
   lastWifiOnline = 0,
   lastWifiReconnect = 0,
-  lastBlindsRead = 0,
   lastOtaHandle = 0,
-  otaUpdateStart = 0,
+  otaUpdateStart = 0;
+
+unsigned long 
+  wifiReconnectMillis = WIFI_RECONNECT_MILLIS,
+  bootOnlineMillis = 0,
   runCounter = 0;
 
 bool 
@@ -33,15 +41,17 @@ char
 Preferences preferences;
 WiFiClient wifiClient;
 PubSub pubsub(wifiClient);
-
-SwitchRelayPin swAudioPower(RELAY_AUDIO_PIN, (SwitchState)preferences.getUChar("audio_state"));
-SwitchRelayPin swBlindsPower(RELAY_BLINDS_POWER_PIN, 0);
-SwitchRelayPin swBlindsDirection(RELAY_BLINDS_DIRECTION_PIN, 0);
-ToggleButton button1(BUTTON_1_PIN, 100, INPUT_PULLUP, (ButtonState)preferences.getUChar("button1_state"));
-AcMotorBlindsController blindsController(swBlindsPower, swBlindsDirection, REEDSWITCH_1_PIN, (BlindsState)preferences.getUChar("blinds_state"));
+PowerManager power;
+WifiCache wifiCache;
+HttpOta httpOta;
+MqttOta mqttOta(pubsub, preferences);
+Telemetry telemetry(pubsub);
+Channels channels(pubsub, preferences, power);
+RuntimeConfig runtimeConfig(pubsub, preferences);
+TraceOutput traceOutput(pubsub);
 
 void restart(char code) {
-  preferences.putULong("SW_RESET_UPTIME", millis());
+  preferences.putULong64("SW_RESET_UPTIME", CLOCK_TO_MS(clock_now()));
   preferences.putUChar("SW_RESET_REASON", code);
   preferences.end();
 
@@ -50,9 +60,11 @@ void restart(char code) {
 }
 
 bool wifiLoop() {
+  wifiCache.loop(now, WiFi.status() == WL_CONNECTED);
+
   if (WiFi.status() != WL_CONNECTED) {
-    if (now - lastWifiOnline > WIFI_WATCHDOG_MILLIS) restart(RESET_ON_WIFI_WD_TIMEOUT);
-    else if (now - lastWifiReconnect > WIFI_RECONNECT_MILLIS) {
+    if (now - lastWifiOnline > CLOCK_MS(WIFI_WATCHDOG_MILLIS)) restart(RESET_ON_WIFI_WD_TIMEOUT);
+    else if (now - lastWifiReconnect > CLOCK_MS(wifiReconnectMillis)) {
       lastWifiReconnect = now;
 
       if (WiFi.reconnect()) {
@@ -70,17 +82,18 @@ bool wifiLoop() {
 }
 
 void otaStarted() {
-  now = millis();
+  now = clock_now();
   otaUpdateStart = now;
   otaUpdateMode = true;
+  power.setFullPower(true);
 }
 
 void otaProgress(unsigned int currentBytes, unsigned int totalBytes) {
-  now = millis();
+  now = clock_now();
 
   unsigned int 
-    minutes = (now-otaUpdateStart)/1000./60.,
-    seconds = (now-otaUpdateStart)/1000. - minutes*60,
+    minutes = (now-otaUpdateStart)/1000000./60.,
+    seconds = (now-otaUpdateStart)/1000000. - minutes*60,
     progress = ((float)currentBytes / totalBytes) * 20;
 
   esp_task_wdt_reset();
@@ -95,61 +108,33 @@ void otaError(ota_error_t error) {
   restart(RESET_ON_OTA_FAIL);
 }
 
-void onPubSubRestart(uint8_t *payload, unsigned int length) {
-  restart(RESET_ON_MQTT_RESET_TOPIC);
-}
-
-void onPubSubBlindsStateSet(uint8_t *payload, unsigned int length) { 
+void onPubSubOtaUrl(uint8_t *payload, unsigned int length) {
   if (length == 0) return;
-
-  if (payload[0] == 'u') {
-    blindsController.pushUp();
-  }
-  else if (payload[0] == 'd') {
-    blindsController.pushDown();
-  }
-  else if (payload[0] == 's') {
-    blindsController.stop();
-  }
+  httpOta.request(payload, length);
 }
 
-void onPubSubAudioStateSet(uint8_t *payload, unsigned int length) {
-  if (length == 0) return;
-
-  if (parseBooleanMessage(payload, length)) swAudioPower.setOn();
-  else swAudioPower.setOff();
-}
-
-void onBlindsStateChanged() {
-  preferences.putUChar("blinds_state", (uint8_t)blindsController.getState());
-  pubsub.publish(MQTT_PATH_PREFIX "/blinds/state", blindsController.getStateString().c_str(), true);
+void onPubSubRestart(uint8_t *payload, unsigned int length) {
+  restart(RESET_ON_MQTT_RESET_TOPIC);
 }
 
-void onButton1StateChanged(ButtonState state) {
-  if (state == ButtonState::On) swAudioPower.setOn();
-  else swAudioPower.setOff();
+void onPubSubPowerPing(uint8_t *payload, unsigned int length) {
+  power.commandReceived();
 
-  preferences.putUChar("button1_state", (uint8_t)state);
-  pubsub.publish(MQTT_PATH_PREFIX "/button_1/state", state == ButtonState::On ? "1" : "0");
+  String pong;
+  pong.concat((const char*)payload, length);
+  pubsub.publish(MQTT_PATH_PREFIX "/power/pong", pong.c_str());
 }
 
-void onAudioPowerStateChanged() {
-  auto state = swAudioPower.getState();
-  if (state == SwitchState::Off) {
-    digitalWrite(BUTTON_1_LED_PIN, 1);
-    pubsub.publish(MQTT_PATH_PREFIX "/audio/state", "1", true);
-  }
-  else {
-    digitalWrite(BUTTON_1_LED_PIN, 0);
-    pubsub.publish(MQTT_PATH_PREFIX "/audio/state", "0", true);
-  }
-
-  preferences.putUChar("audio_state", (uint8_t)state);
+void onRuntimeConfigApply(const runtime_config_t& config) {
+  channels.applyConfig(config);
+  pubsub.setReconnectInterval(config.mqttReconnectMs);
+  wifiReconnectMillis = config.wifiReconnectMs;
 }
 
 void setup() {
   reset_reason[0] = rtc_get_reset_reason(0);
   reset_reason[1] = rtc_get_reset_reason(1);
+  traceOutput.begin();
 
   preferences.begin("roller-02");
   runCounter = preferences.getULong("__RUN_N", 0) + 1;
@@ -161,11 +146,16 @@ void setup() {
   esp_task_wdt_init(WDT_TIMEOUT_SEC, true);
   esp_task_wdt_add(NULL);
 
+  configTime(0, 0, NTP_SERVER);   // wall clock for event timestamps only, nothing schedules on it
+
   WiFi.setHostname(WIFI_HOSTNAME);
   WiFi.setAutoConnect(true);
   WiFi.setAutoReconnect(true);
-  WiFi.setSleep(wifi_ps_type_t::WIFI_PS_NONE);
-  WiFi.begin(WIFI_SSID, WIFI_PASSPHRASE);
+  power.begin();
+  wifiCache.onConfigure([]() { power.applyListenInterval(); });
+  if (wifiCache.begin(preferences) != WIFI_CONNECT_FULL) {
+    pubsub.setServerAddress(wifiCache.getBrokerAddress());
+  }
 
   ArduinoOTA.setRebootOnSuccess(true);
   ArduinoOTA.onStart(otaStarted);
@@ -174,17 +164,22 @@ void setup() {
   ArduinoOTA.onError(otaError);
   ArduinoOTA.begin();
 
-  pinMode(BUTTON_1_LED_PIN, OUTPUT);
-
+  pubsub.setBufferSize(MQTT_BUFFER_SIZE);
   pubsub.subscribe(MQTT_PATH_PREFIX "/restart", MQTTQOS0, onPubSubRestart);
-  pubsub.subscribe(MQTT_PATH_PREFIX "/blinds/state/set", MQTTQOS0, onPubSubBlindsStateSet);
-  pubsub.subscribe(MQTT_PATH_PREFIX "/audio/state/set", MQTTQOS0, onPubSubAudioStateSet);
+  pubsub.subscribe(MQTT_PATH_PREFIX "/ota/url", MQTTQOS0, onPubSubOtaUrl);
+  pubsub.subscribe(MQTT_PATH_PREFIX "/ota/begin", MQTTQOS0, [](uint8_t* p, unsigned int l) { mqttOta.onBegin(p, l); });
+  pubsub.subscribe(MQTT_PATH_PREFIX "/ota/chunk", MQTTQOS0, [](uint8_t* p, unsigned int l) { mqttOta.onChunk(p, l); });
+  pubsub.subscribe(MQTT_PATH_PREFIX "/ota/abort", MQTTQOS0, [](uint8_t* p, unsigned int l) { mqttOta.onAbort(p, l); });
+  pubsub.subscribe(MQTT_PATH_PREFIX "/power/ping", MQTTQOS0, onPubSubPowerPing);
+
+  pubsub.subscribe(MQTT_CONFIG_TOPIC, MQTTQOS0, [](uint8_t* p, unsigned int l) { runtimeConfig.onMessage(p, l); });
 
-  blindsController.onBlindsStateChanged(onBlindsStateChanged);
-  button1.onButtonStateChanged(onButton1StateChanged);
-  swAudioPower.onStateChanged(onAudioPowerStateChanged);
+  channels.begin();
+  runtimeConfig.onApply(onRuntimeConfigApply);
+  runtimeConfig.onResetTravel([]() { channels.resetTravelStats(); });
+  runtimeConfig.begin();
 
-  now = millis();
+  now = clock_now();
   lastWifiOnline = now;
 }
 
@@ -192,51 +187,83 @@ bool onJustStarted() {
   bool result = true;
   result &= pubsub.publish(MQTT_PATH_PREFIX "/restart_reason/0", get_reset_reason_info(reset_reason[0]).c_str(), true);
   result &= pubsub.publish(MQTT_PATH_PREFIX "/restart_reason/1", get_reset_reason_info(reset_reason[1]).c_str(), true);
-  result &= pubsub.publish(MQTT_PATH_PREFIX "/restart_reason/uptime", String(preferences.getULong("SW_RESET_UPTIME", 0)).c_str(), true);
+  result &= pubsub.publish(MQTT_PATH_PREFIX "/restart_reason/uptime", String((unsigned long long)preferences.getULong64("SW_RESET_UPTIME", 0)).c_str(), true);
   result &= pubsub.publish(MQTT_PATH_PREFIX "/restart_reason/code", String((uint8_t)sw_reset_reason).c_str(), true);
   result &= pubsub.publish(MQTT_PATH_PREFIX "/restart_reason/sw", get_sw_reset_reason_info(sw_reset_reason).c_str(), true);
   result &= pubsub.publish(MQTT_PATH_PREFIX "/restart_reason/run_id", String(runCounter-1).c_str(), true);
 
-  result &= pubsub.publish(MQTT_PATH_PREFIX "/button_1/state", button1.getState() == ButtonState::On ? "1" : "0", true);
-  result &= pubsub.publish(MQTT_PATH_PREFIX "/blinds/state", blindsController.getStateString().c_str(), true);
-  result &= pubsub.publish(MQTT_PATH_PREFIX "/audio/state", swAudioPower.getState() == SwitchState::On ? "1" : "0", true);
-  onBlindsStateChanged();
+  result &= channels.publishStates();
 
   return result;
 }
 
-bool pubsub_loop(unsigned long now) {
+bool pubsub_loop(clock_us_t now) {
   return pubsub.loop(now);
 }
 
+// Boot-to-first-publish: the restart burst has made it to the broker
+void onFirstPublish() {
+  bootOnlineMillis = CLOCK_TO_MS(clock_now());
+
+  pubsub.publish(MQTT_PATH_PREFIX "/restart_reason/online_ms", String(bootOnlineMillis).c_str(), true);
+  pubsub.publish(MQTT_PATH_PREFIX "/restart_reason/wifi_connect_mode", String(wifiCache.getConnectMode()).c_str(), true);
+
+  wifiCache.store();
+}
+
 void loop() {
   esp_task_wdt_reset();
 
-  auto before = now;
-  now = millis();
+  now = clock_now();
   
   if (otaUpdateMode) {
-    if (now - otaUpdateStart > OTA_UPDATE_TIMEOUT_MILLIS) restart(RESET_ON_OTA_TIMEOUT);
+    if (now - otaUpdateStart > CLOCK_MS(OTA_UPDATE_TIMEOUT_MILLIS)) restart(RESET_ON_OTA_TIMEOUT);
     
     ArduinoOTA.handle();
     return;
   }
 
-  blindsController.loop(now);
-  button1.loop(now);
+  channels.loop(now);
 
   if (wifiLoop()) {
     if (justStarted) {
       justStarted = !onJustStarted();
     }
 
-    pubsub_loop(now);
+    if (pubsub_loop(now) && !justStarted && bootOnlineMillis == 0) {
+      onFirstPublish();
+    }
+    power.loop(now, pubsub);
+
+    if (mqttOta.loop(now)) restart(RESET_ON_OTA_SUCCESS);
+    telemetry.loop(now);
   }
 
-  if (now - lastOtaHandle > 2000) {
+  // run() blocks the loop: with the blinds moving, the reed switch cut-off would never be polled
+  if (httpOta.isRequested() && channels.isRolling()) {
+    httpOta.cancel();
+    pubsub.publish(MQTT_PATH_PREFIX "/ota/status", "rejected:blinds_rolling");
+  }
+  else if (httpOta.isRequested()) {
+    // a bad URL or response is reported, only a started write into the OTA partition is worth a restart
+    char code = httpOta.run(otaStarted, otaProgress);
+    if (code != RESET_NO_ERROR) restart(code);
+
+    String status("failed:");
+    status.concat(httpOta.getFailure());
+    pubsub.publish(MQTT_PATH_PREFIX "/ota/status", status.c_str());
+  }
+
+  if (now - lastOtaHandle > CLOCK_MS(2000)) {
     lastOtaHandle = now;
     ArduinoOTA.handle();
   }
+
+  telemetry.recordLoop(clock_now() - now);
+  traceOutput.loop(now);
+
+  power.setFullPower(channels.isRolling() || mqttOta.isActive());
+  power.idle();
 }
 
 /* TOOLS */
@@ -0,0 +1,158 @@
+#ifndef __OTA_HTTP_H
+#define __OTA_HTTP_H
+
+#include <Arduino.h>
+#include <HTTPClient.h>
+#include <Update.h>
+#include <esp_task_wdt.h>
+#include <HeatshrinkDecoder.h>
+#include <Clock.h>
+#include "app.h"
+#include "reset_info.h"
+
+// Pull-based OTA: downloads a heatshrink-compressed image (build/compress_firmware.py)
+// and decompresses it straight into the OTA partition. Plain .bin images are accepted too.
+class HttpOta {
+  public:
+    void request(uint8_t* payload, unsigned int length) {
+      url = String();
+      url.concat((const char*)payload, length);
+    }
+
+    bool isRequested() {
+      return url.length() > 0;
+    }
+
+    void cancel() {
+      url = String();
+    }
+
+    uint32_t getBytesReceived() {
+      return bytesReceived;
+    }
+
+    // Why the last run() gave up before writing anything, for <prefix>/ota/status
+    const char* getFailure() {
+      return failure.c_str();
+    }
+
+    // Blocks until the update completes (nothing else in the loop runs meanwhile). Returns RESET_NO_ERROR
+    // if the request failed before anything was written (see getFailure(), nothing to restart for),
+    // otherwise the RESET_ON_* code to restart with. onStarted runs once Update.begin() took the image.
+    char run(std::function<void()> onStarted, std::function<void(uint32_t, uint32_t)> onProgress) {
+      HTTPClient http;
+      String target = url;
+      url = String();
+      bytesReceived = 0;
+      failure = String();
+
+      clock_us_t startedAt = clock_now();
+      if (!http.begin(target)) return fail("url");
+
+      int code = http.GET();
+      if (code < 0) return fail("connect");
+      if (code != HTTP_CODE_OK) {
+        String reason("http_");
+        reason.concat(code);
+        return fail(reason);
+      }
+
+      auto stream = http.getStreamPtr();
+      int contentLength = http.getSize();
+
+      uint8_t header[HEATSHRINK_IMAGE_HEADER_SIZE];
+      if (!readFully(*stream, header, sizeof(header), startedAt)) return fail("read_timeout");
+      bytesReceived += sizeof(header);
+
+      heatshrink_image_header_t image;
+      bool compressed = image.parse(header);
+      uint32_t imageSize = compressed ? image.size : (uint32_t)contentLength;
+
+      if (contentLength <= 0 && !compressed) return fail("no_content_length");
+      if (!Update.begin(imageSize)) return fail("update_begin");
+      onStarted();
+
+      auto sink = [](const uint8_t* data, size_t length) {
+        return Update.write((uint8_t*)data, length) == length;
+      };
+
+      if (compressed) {
+        Update.setMD5(toHex(image.md5, sizeof(image.md5)).c_str());
+        if (!decoder.reset(image.windowBits, image.lookaheadBits, image.size)) return abort(RESET_ON_OTA_FAIL);
+      }
+      else if (!sink(header, sizeof(header))) {
+        return abort(RESET_ON_OTA_FAIL);
+      }
+
+      uint8_t buffer[OTA_HTTP_BUFFER_SIZE];
+      while (compressed ? !decoder.isComplete() : Update.progress() < imageSize) {
+        if (clock_now() - startedAt > CLOCK_MS(OTA_UPDATE_TIMEOUT_MILLIS)) return abort(RESET_ON_OTA_TIMEOUT);
+        if (!http.connected() && stream->available() == 0) return abort(RESET_ON_OTA_FAIL);
+
+        size_t available = stream->available();
+        if (available == 0) {
+          esp_task_wdt_reset();   // a stalled link must end in RESET_ON_OTA_TIMEOUT, not a WDT panic
+          delay(1);
+          continue;
+        }
+
+        int n = stream->read(buffer, min(available, sizeof(buffer)));
+        if (n <= 0) continue;
+        bytesReceived += n;
+
+        if (compressed ? !decoder.decode(buffer, n, sink) : !sink(buffer, n)) return abort(RESET_ON_OTA_FAIL);
+
+        onProgress(Update.progress(), imageSize);
+        esp_task_wdt_reset();
+      }
+
+      if (compressed && !decoder.flush(sink)) return abort(RESET_ON_OTA_FAIL);
+      return Update.end() ? RESET_ON_OTA_SUCCESS : RESET_ON_OTA_FAIL;
+    }
+
+  private:
+    String url;
+    uint32_t bytesReceived = 0;
+    String failure;
+    HeatshrinkDecoder<OTA_HTTP_WINDOW_BITS> decoder;
+
+    char fail(const String& reason) {
+      failure = reason;
+      return RESET_NO_ERROR;
+    }
+
+    static char abort(char code) {
+      Update.abort();
+      return code;
+    }
+
+    static bool readFully(Stream& stream, uint8_t* buffer, size_t length, clock_us_t startedAt) {
+      size_t offset = 0;
+      while (offset < length) {
+        if (clock_now() - startedAt > CLOCK_MS(OTA_UPDATE_TIMEOUT_MILLIS)) return false;
+
+        if (stream.available() == 0) {
+          esp_task_wdt_reset();
+          delay(1);
+          continue;
+        }
+
+        offset += stream.readBytes(buffer + offset, length - offset);
+      }
+
+      return true;
+    }
+
+    static String toHex(const uint8_t* data, size_t length) {
+      static const char digits[] = "0123456789abcdef";
+
+      String result;
+      for (size_t i = 0; i < length; i++) {
+        result.concat(digits[data[i] >> 4]);
+        result.concat(digits[data[i] & 0x0f]);
+      }
+      return result;
+    }
+};
+
+#endif
@@ -0,0 +1,340 @@
+#ifndef __OTA_MQTT_H
+#define __OTA_MQTT_H
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <esp_partition.h>
+#include <esp_ota_ops.h>
+#include <esp_task_wdt.h>
+#include <mbedtls/sha256.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <Clock.h>
+#include "app.h"
+#include "pubsub.h"
+
+#define OTA_MQTT_SECTOR_SIZE          4096
+
+#define OTA_MQTT_IDLE                 0
+#define OTA_MQTT_RECEIVING            1
+#define OTA_MQTT_VERIFIED             2
+#define OTA_MQTT_FAILED               3
+
+// Resumable OTA over the MQTT connection (see tools/ota_mqtt_send.py):
+//   <prefix>/ota/begin  "<size> <chunk size> <sha256 hex>"   starts or resumes a session
+//   <prefix>/ota/chunk  u32 LE chunk index + chunk data
+//   <prefix>/ota/abort
+// The device answers on <prefix>/ota/progress with the next chunk index it expects.
+// Chunks are collected into two sector-sized buffers: one fills from the MQTT callback
+// while a writer task erases/writes the other and hashes it. Flushed sectors are the
+// committed offset, persisted to NVS so a restart resumes from there.
+class MqttOta {
+  public:
+    MqttOta(PubSub& pubsub, Preferences& preferences) : pubsub(pubsub), preferences(preferences)
+    { }
+
+    void onBegin(uint8_t* payload, unsigned int length) {
+      char text[96];
+      if (length >= sizeof(text)) return;
+      memcpy(text, payload, length);
+      text[length] = 0;
+
+      unsigned long size = 0, chunkSize = 0;
+      char shaHex[65];
+      uint8_t sha[32];
+      if (sscanf(text, "%lu %lu %64s", &size, &chunkSize, shaHex) != 3 || !parseHex(shaHex, sha, sizeof(sha))) {
+        return fail("bad_begin");
+      }
+
+      if (chunkSize == 0 || chunkSize > OTA_MQTT_MAX_CHUNK_SIZE || OTA_MQTT_SECTOR_SIZE % chunkSize != 0) return fail("bad_chunk_size");
+
+      if (state == OTA_MQTT_VERIFIED && memcmp(sha, expectedSha, sizeof(sha)) == 0) {
+        publishStatus("verified", true);
+        return;
+      }
+
+      if (state == OTA_MQTT_RECEIVING && size == totalSize && chunkSize == this->chunkSize && memcmp(sha, expectedSha, sizeof(sha)) == 0) {
+        publishProgress();
+        return;
+      }
+
+      partition = esp_ota_get_next_update_partition(NULL);
+      if (partition == NULL || size == 0 || size > partition->size) return fail("bad_size");
+
+      if (!startWriter()) return fail("no_memory");
+
+      totalSize = size;
+      this->chunkSize = chunkSize;
+      memcpy(expectedSha, sha, sizeof(sha));
+      mbedtls_sha256_init(&shaContext);
+      mbedtls_sha256_starts_ret(&shaContext, 0);
+
+      // Same image as the persisted session: rehash what is already in flash and continue from there
+      uint32_t resumeOffset = 0;
+      uint8_t persistedSha[32];
+      if (preferences.getBytes("ota_sha", persistedSha, sizeof(persistedSha)) == sizeof(persistedSha)
+        && memcmp(persistedSha, sha, sizeof(sha)) == 0
+        && preferences.getULong("ota_size") == size
+        && preferences.getULong("ota_chunk") == chunkSize) {
+        resumeOffset = rehash(preferences.getULong("ota_off"));
+      }
+      else {
+        preferences.putBytes("ota_sha", sha, sizeof(sha));
+        preferences.putULong("ota_size", size);
+        preferences.putULong("ota_chunk", chunkSize);
+        preferences.putULong("ota_off", 0);
+      }
+
+      committedOffset = persistedOffset = receivedOffset = resumeOffset;
+      fillLength = 0;
+      writeError = false;
+      state = OTA_MQTT_RECEIVING;
+
+      publishStatus("receiving");
+      publishProgress();
+    }
+
+    void onChunk(uint8_t* payload, unsigned int length) {
+      if (state != OTA_MQTT_RECEIVING || length < 4) return;
+
+      uint32_t index = payload[0] | (payload[1] << 8) | (payload[2] << 16) | ((uint32_t)payload[3] << 24);
+      uint32_t dataLength = length - 4;
+      uint32_t offset = index * chunkSize;
+
+      // Duplicate or out of order: tell the sender where we are
+      if (offset != receivedOffset || dataLength > chunkSize || (dataLength < chunkSize && offset + dataLength != totalSize)) {
+        publishProgress();
+        return;
+      }
+
+      if (offset + dataLength > totalSize) return fail("overflow");
+
+      memcpy(buffers[fillBuffer] + fillLength, payload + 4, dataLength);
+      fillLength += dataLength;
+      receivedOffset += dataLength;
+      lastChunkReceived = clock_now();
+
+      if (fillLength == OTA_MQTT_SECTOR_SIZE || receivedOffset == totalSize) {
+        submitFillBuffer();
+      }
+    }
+
+    void onAbort(uint8_t* payload, unsigned int length) {
+      if (state == OTA_MQTT_IDLE) return;
+
+      waitForWriter();
+      clearSession();
+      state = OTA_MQTT_IDLE;
+      publishStatus("aborted");
+    }
+
+    bool isActive() {
+      return state == OTA_MQTT_RECEIVING;
+    }
+
+    // Persists progress, reports it and finishes the update; returns true when the new image is ready to boot
+    // and the sender was told (the caller restarts right away, so nothing left in the PubSub queue goes out)
+    bool loop(clock_us_t now) {
+      if (state == OTA_MQTT_VERIFIED) return announceVerified(now);
+      if (state != OTA_MQTT_RECEIVING) return false;
+
+      if (writeError) {
+        fail("flash_write");
+        return false;
+      }
+
+      uint32_t committed = committedOffset;
+      if (committed != persistedOffset) {
+        persistedOffset = committed;
+        preferences.putULong("ota_off", committed);
+        publishProgress(committed == totalSize);
+      }
+      else if (now - lastChunkReceived > CLOCK_MS(OTA_MQTT_PROGRESS_MILLIS) && now - lastProgressPublish > CLOCK_MS(OTA_MQTT_PROGRESS_MILLIS)) {
+        // Sender went quiet (dropped link?): keep advertising where to resume
+        publishProgress();
+      }
+
+      if (committed < totalSize) return false;
+
+      uint8_t sha[32];
+      mbedtls_sha256_finish_ret(&shaContext, sha);
+      mbedtls_sha256_free(&shaContext);
+      clearSession();
+      state = OTA_MQTT_IDLE;
+
+      if (memcmp(sha, expectedSha, sizeof(sha)) != 0) {
+        fail("sha256_mismatch");
+        return false;
+      }
+
+      if (esp_ota_set_boot_partition(partition) != ESP_OK) {
+        fail("bad_image");
+        return false;
+      }
+
+      state = OTA_MQTT_VERIFIED;
+      verifiedAt = now;
+      verifiedAnnounced = false;
+      return announceVerified(now);
+    }
+
+  private:
+    struct ota_block_t {
+      uint8_t buffer;
+      uint32_t offset;
+      uint32_t length;
+    };
+
+    PubSub& pubsub;
+    Preferences& preferences;
+    const esp_partition_t* partition = NULL;
+    mbedtls_sha256_context shaContext;
+    uint8_t expectedSha[32];
+    uint8_t state = OTA_MQTT_IDLE;
+    uint32_t totalSize = 0, chunkSize = 0, receivedOffset = 0, persistedOffset = 0, fillLength = 0;
+    volatile uint32_t committedOffset = 0;
+    volatile bool writeError = false;
+    clock_us_t lastChunkReceived = 0, lastProgressPublish = 0, verifiedAt = 0;
+    bool verifiedAnnounced = false;
+
+    uint8_t* buffers[2] = { NULL, NULL };
+    uint8_t fillBuffer = 0;
+    TaskHandle_t writer = NULL;
+    QueueHandle_t blocks = NULL;
+    SemaphoreHandle_t freeBuffers = NULL;
+
+    bool startWriter() {
+      if (writer != NULL) {
+        waitForWriter();
+        return true;
+      }
+
+      if (buffers[0] == NULL) buffers[0] = (uint8_t*)malloc(OTA_MQTT_SECTOR_SIZE);
+      if (buffers[1] == NULL) buffers[1] = (uint8_t*)malloc(OTA_MQTT_SECTOR_SIZE);
+      if (blocks == NULL) blocks = xQueueCreate(2, sizeof(ota_block_t));
+      if (freeBuffers == NULL) freeBuffers = xSemaphoreCreateCounting(2, 2);
+
+      if (buffers[0] == NULL || buffers[1] == NULL || blocks == NULL || freeBuffers == NULL) return false;
+      if (xTaskCreate(MqttOta::writerTask, "ota_writer", 4096, this, 1, &writer) != pdPASS) return false;
+
+      // The fill buffer is always held by the receiving side
+      xSemaphoreTake(freeBuffers, portMAX_DELAY);
+      fillBuffer = 0;
+      return true;
+    }
+
+    // Blocks until the writer has flushed everything handed to it
+    void waitForWriter() {
+      if (writer == NULL) return;
+
+      xSemaphoreTake(freeBuffers, portMAX_DELAY);
+      xSemaphoreGive(freeBuffers);
+    }
+
+    void submitFillBuffer() {
+      ota_block_t block = { fillBuffer, receivedOffset - fillLength, fillLength };
+      xQueueSend(blocks, &block, portMAX_DELAY);
+
+      // Only waits if the writer is still busy with the other buffer
+      xSemaphoreTake(freeBuffers, portMAX_DELAY);
+      fillBuffer ^= 1;
+      fillLength = 0;
+    }
+
+    static void writerTask(void* arg) {
+      auto self = (MqttOta*)arg;
+      ota_block_t block;
+
+      for (;;) {
+        if (xQueueReceive(self->blocks, &block, portMAX_DELAY) != pdTRUE) continue;
+
+        auto data = self->buffers[block.buffer];
+        if (esp_partition_erase_range(self->partition, block.offset, OTA_MQTT_SECTOR_SIZE) != ESP_OK
+          || esp_partition_write(self->partition, block.offset, data, block.length) != ESP_OK) {
+          self->writeError = true;
+        }
+        else {
+          mbedtls_sha256_update_ret(&self->shaContext, data, block.length);
+          self->committedOffset = block.offset + block.length;
+        }
+
+        xSemaphoreGive(self->freeBuffers);
+      }
+    }
+
+    // Rebuilds the hash state from flash after a restart; returns the offset to resume from
+    uint32_t rehash(uint32_t offset) {
+      offset -= offset % OTA_MQTT_SECTOR_SIZE;
+      if (offset > totalSize) offset = 0;
+
+      auto buffer = buffers[fillBuffer];
+      for (uint32_t p = 0; p < offset; p += OTA_MQTT_SECTOR_SIZE) {
+        if (esp_partition_read(partition, p, buffer, OTA_MQTT_SECTOR_SIZE) != ESP_OK) {
+          mbedtls_sha256_starts_ret(&shaContext, 0);
+          return 0;
+        }
+
+        mbedtls_sha256_update_ret(&shaContext, buffer, OTA_MQTT_SECTOR_SIZE);
+        esp_task_wdt_reset();
+      }
+
+      return offset;
+    }
+
+    void clearSession() {
+      preferences.remove("ota_sha");
+      preferences.remove("ota_size");
+      preferences.remove("ota_chunk");
+      preferences.remove("ota_off");
+    }
+
+    void fail(const char* reason) {
+      if (state == OTA_MQTT_RECEIVING) {
+        waitForWriter();
+        mbedtls_sha256_free(&shaContext);
+      }
+
+      state = OTA_MQTT_FAILED;
+
+      String status("failed:");
+      status.concat(reason);
+      publishStatus(status.c_str());
+    }
+
+    // Without "verified" the sender re-sends begin to the new firmware, which then flashes the image again;
+    // retried while the connection is down, but the image is booted after OTA_MQTT_PROGRESS_MILLIS regardless
+    bool announceVerified(clock_us_t now) {
+      if (!verifiedAnnounced) verifiedAnnounced = publishStatus("verified", true);
+      return verifiedAnnounced || now - verifiedAt > CLOCK_MS(OTA_MQTT_PROGRESS_MILLIS);
+    }
+
+    bool publishStatus(const char* status, bool immediately = false) {
+      if (immediately) return pubsub.publish_now(MQTT_PATH_PREFIX "/ota/status", (const uint8_t*)status, strlen(status));
+      return pubsub.publish(MQTT_PATH_PREFIX "/ota/status", status);
+    }
+
+    void publishProgress(bool immediately = false) {
+      lastProgressPublish = clock_now();
+      // rounded up: after a short last chunk the sender must see all chunks as received
+      String progress(chunkSize > 0 ? (receivedOffset + chunkSize - 1) / chunkSize : 0);
+      if (immediately) pubsub.publish_now(MQTT_PATH_PREFIX "/ota/progress", (const uint8_t*)progress.c_str(), progress.length());
+      else pubsub.publish(MQTT_PATH_PREFIX "/ota/progress", progress.c_str());
+    }
+
+    static bool parseHex(const char* hex, uint8_t* out, size_t length) {
+      if (strlen(hex) != length * 2) return false;
+
+      for (size_t i = 0; i < length * 2; i++) {
+        char c = hex[i];
+        uint8_t v = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : 0xff;
+        if (v == 0xff) return false;
+
+        out[i / 2] = (i % 2 == 0) ? v << 4 : out[i / 2] | v;
+      }
+
+      return true;
+    }
+};
+
+#endif
@@ -0,0 +1,193 @@
+#ifndef __POWER_H
+#define __POWER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <WiFi.h>
+#include <esp_wifi.h>
+#include <esp_pm.h>
+#include <esp_sleep.h>
+#include <driver/gpio.h>
+#include <hal/gpio_ll.h>
+#include <vector>
+#include <Clock.h>
+#include "app.h"
+#include "pubsub.h"
+
+#define POWER_MODE_FULL               0   // radio always on, loop busy-polls (legacy behaviour)
+#define POWER_MODE_MODEM              1   // modem sleep with DTIM listen interval, loop idles between passes
+#define POWER_MODE_LIGHT              2   // modem sleep + automatic light sleep, GPIO wake-up
+
+class PowerManager {
+  public:
+    PowerManager(uint8_t mode = POWER_MODE, uint8_t listenInterval = WIFI_LISTEN_INTERVAL, unsigned long idleMaxMs = POWER_IDLE_MAX_MILLIS)
+      : mode(mode), listenInterval(listenInterval), idleMaxMs(idleMaxMs)
+    { }
+
+    // Must be called from the loop task (i.e. from setup()) before WiFi.begin()
+    void begin() {
+      loopTask = xTaskGetCurrentTaskHandle();
+      WiFi.mode(WIFI_STA);
+      if (mode == POWER_MODE_FULL) {
+        WiFi.setSleep(WIFI_PS_NONE);
+        return;
+      }
+
+#if CONFIG_PM_ENABLE
+      if (mode == POWER_MODE_LIGHT) {
+        esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "roller_busy", &busyLock);
+  #if CONFIG_IDF_TARGET_ESP32S2
+        esp_pm_config_esp32s2_t pm = { .max_freq_mhz = CONFIG_ESP32S2_DEFAULT_CPU_FREQ_MHZ, .min_freq_mhz = 80, .light_sleep_enable = true };
+  #else
+        esp_pm_config_esp32_t pm = { .max_freq_mhz = CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ, .min_freq_mhz = 80, .light_sleep_enable = true };
+  #endif
+        if (esp_pm_configure(&pm) != ESP_OK) mode = POWER_MODE_MODEM;
+        else esp_sleep_enable_gpio_wakeup();
+      }
+#else
+      if (mode == POWER_MODE_LIGHT) {
+        log_w("Light sleep requires CONFIG_PM_ENABLE, falling back to modem sleep");
+        mode = POWER_MODE_MODEM;
+      }
+#endif
+
+      applySleep();
+    }
+
+    // Interrupt on any edge of the pin wakes the loop immediately (button, reed switch)
+    void wakeOnPin(uint8_t pin) {
+      wakePins.push_back(pin);
+      wakeMask[pin / 32] |= 1UL << (pin % 32);
+      attachInterruptArg(pin, PowerManager::onPinEdge, this, CHANGE);
+    }
+
+    // Full power while the motor is rolling or OTA is in progress
+    void setFullPower(bool value) {
+      if (fullPower == value) return;
+      fullPower = value;
+      applySleep();
+    }
+
+    // The interval is announced in the association request and WiFi.begin() writes a fresh station config
+    // without it: call between WiFi.begin(..., false) and esp_wifi_connect() so the AP buffers for the
+    // interval we actually sleep for
+    void applyListenInterval() {
+      if (mode == POWER_MODE_FULL) return;
+
+      wifi_config_t conf;
+      if (esp_wifi_get_config(WIFI_IF_STA, &conf) != ESP_OK || conf.sta.listen_interval == listenInterval) return;
+      conf.sta.listen_interval = listenInterval;
+      esp_wifi_set_config(WIFI_IF_STA, &conf);
+    }
+
+    bool isFullPower() {
+      return fullPower || mode == POWER_MODE_FULL;
+    }
+
+    // Called by inbound command handlers: records how long the loop idled before picking the command up
+    void commandReceived() {
+      commands++;
+      commandWaitTotalUs += lastIdleUs;
+      if (lastIdleUs > commandWaitMaxUs) commandWaitMaxUs = lastIdleUs;
+    }
+
+    // Blocks for at most idleMaxMs or until a GPIO edge, unless in full power mode
+    void idle() {
+      if (isFullPower()) {
+        lastIdleUs = 0;
+        return;
+      }
+
+      if (mode == POWER_MODE_LIGHT) {
+        // level-triggered wake-up: arm for the opposite of the current level so a held input doesn't keep us awake
+        for (auto pin : wakePins) {
+          gpio_wakeup_enable((gpio_num_t)pin, digitalRead(pin) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+        }
+      }
+
+      auto start = micros();
+      if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(idleMaxMs)) > 0) gpioWakeups++;
+      lastIdleUs = micros() - start;
+      idleTotalUs += lastIdleUs;
+
+      if (mode == POWER_MODE_LIGHT) {
+        // gpio_wakeup_enable() switched the pin interrupt to level: back to edges, also for pins that didn't fire
+        for (auto pin : wakePins) {
+          gpio_wakeup_disable((gpio_num_t)pin);
+          gpio_set_intr_type((gpio_num_t)pin, GPIO_INTR_ANYEDGE);
+        }
+      }
+    }
+
+    // Periodically publishes and resets the latency/sleep statistics
+    void loop(clock_us_t now, PubSub& pubsub) {
+      if (now - lastStatsPublish < CLOCK_MS(POWER_STATS_MILLIS)) return;
+
+      unsigned long windowMs = CLOCK_TO_MS(now - lastStatsPublish);
+      lastStatsPublish = now;
+
+      StaticJsonDocument<256> doc;
+      doc["mode"] = mode;
+      doc["listen_interval"] = listenInterval;
+      doc["window_ms"] = windowMs;
+      doc["idle_ms"] = (unsigned long)(idleTotalUs / 1000);
+      doc["gpio_wakeups"] = gpioWakeups;
+      doc["commands"] = commands;
+      doc["cmd_wait_avg_ms"] = commands > 0 ? (unsigned long)(commandWaitTotalUs / commands / 1000) : 0;
+      doc["cmd_wait_max_ms"] = (unsigned long)(commandWaitMaxUs / 1000);
+
+      char stats[192];
+      serializeJson(doc, stats, sizeof(stats));
+
+      if (pubsub.publish(MQTT_PATH_PREFIX "/power/stats", stats)) {
+        idleTotalUs = commandWaitTotalUs = 0;
+        commandWaitMaxUs = 0;
+        gpioWakeups = commands = 0;
+      }
+    }
+
+  private:
+    uint8_t mode, listenInterval;
+    unsigned long idleMaxMs, lastIdleUs = 0, commandWaitMaxUs = 0;
+    clock_us_t lastStatsPublish = 0;
+    unsigned long gpioWakeups = 0, commands = 0;
+    uint64_t idleTotalUs = 0, commandWaitTotalUs = 0;
+    bool fullPower = false;
+    TaskHandle_t loopTask = NULL;
+    std::vector<uint8_t> wakePins;
+    uint32_t wakeMask[2] = { 0, 0 };   // wakePins for the ISR, split like GPIO_IN_REG/GPIO_IN1_REG
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_handle_t busyLock = NULL;
+#endif
+
+    void applySleep() {
+      if (mode == POWER_MODE_FULL) return;
+
+      WiFi.setSleep(fullPower ? WIFI_PS_NONE : WIFI_PS_MAX_MODEM);
+
+#if CONFIG_PM_ENABLE
+      if (busyLock != NULL) {
+        if (fullPower) esp_pm_lock_acquire(busyLock);
+        else esp_pm_lock_release(busyLock);
+      }
+#endif
+    }
+
+    static void IRAM_ATTR onPinEdge(void* arg) {
+      auto self = (PowerManager*)arg;
+      // an armed level interrupt would re-fire for as long as the level holds and starve the loop task;
+      // register writes only, gpio_set_intr_type() isn't safe to call from an IRAM ISR
+      for (int word = 0; word < 2; word++) {
+        for (uint32_t mask = self->wakeMask[word]; mask != 0; mask &= mask - 1) {
+          gpio_ll_set_intr_type(&GPIO, (gpio_num_t)(word * 32 + __builtin_ctz(mask)), GPIO_INTR_ANYEDGE);
+        }
+      }
+      if (self->loopTask == NULL) return;
+
+      BaseType_t woken = pdFALSE;
+      vTaskNotifyGiveFromISR(self->loopTask, &woken);
+      if (woken == pdTRUE) portYIELD_FROM_ISR();
+    }
+};
+
+#endif
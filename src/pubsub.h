@@ -3,34 +3,84 @@
 
 #include <Arduino.h>
 #include <WiFi.h>
-#include <PubSubClient.h>
+#include <MqttClient.h>
+#include <Clock.h>
+#include <algorithm>
 #include <queue>
 #include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <Trace.h>
 #include "app.h"
 
 class PubSub {
   public:
     typedef std::function<void(uint8_t*, unsigned int)> message_handler_t;
 
-    PubSub(Client& client) : pubSubClient(new PubSubClient(client))
+    // Token bucket for an inbound topic: up to `burst` messages, one more every `refillMs`.
+    // With `coalesce`, messages are held and only the latest is handed over, at most once per loop.
+    // Messages `bypass` returns true for (e.g. a stop command) go through at once and discard any held one.
+    struct rate_limit_t {
+      uint8_t burst;
+      unsigned long refillMs;
+      bool coalesce;
+      std::function<bool(const uint8_t*, unsigned int)> bypass;
+    };
+
+    PubSub(Client& client) : client(client), pubSubClient(new MqttClient(client))
     { 
       pubSubClient->setServer(MQTT_SERVER_NAME, MQTT_SERVER_PORT);
+      pubSubClient->setProtocolVersion(MQTT_PROTOCOL_VERSION);
+      pubSubClient->setTopicAliasMaximum(MQTT_TOPIC_ALIAS_MAX);
       pubSubClient->setCallback([this](char* t, uint8_t* p, unsigned int l) { this->mqtt_on_message(t, p, l); });
     }
 
+    // Connect to a known broker address (skips DNS), reverting to MQTT_SERVER_NAME if that fails
+    void setServerAddress(IPAddress address) {
+      if ((uint32_t)address == 0) return;
+
+      pubSubClient->setServer(address, MQTT_SERVER_PORT);
+      usingServerAddress = true;
+    }
+
+    void setReconnectInterval(unsigned long ms) {
+      reconnectIntervalMs = ms;
+    }
+
+    bool setBufferSize(uint16_t size) {
+      return pubSubClient->setBufferSize(size);
+    }
+
     bool connect() {
       return mqtt_loop(0);
     }
 
+    bool connected() {
+      return pubSubClient->connected();
+    }
+
     void subscribe(const char* topic, uint8_t qos, message_handler_t handler) {
       topicSubscriptions.push_back(topic_subscription_t(topic, qos, handler));
+      topicIndex.emplace(topic, &topicSubscriptions.back());
 #ifdef DEBUG
       debug_publish_subscriptions();
 #endif
     }
 
+    void subscribe(const char* topic, uint8_t qos, message_handler_t handler, const rate_limit_t& limit) {
+      subscribe(topic, qos, handler);
+
+      auto& s = topicSubscriptions.back();
+      s.limited = true;
+      s.limit = limit;
+      s.tokens = limit.burst;
+      s.lastRefill = clock_now();
+    }
+
     void subscribe(const char* topic, message_handler_t handler) {
       topicSubscriptions.push_back(topic_subscription_t(topic, handler));
+      topicIndex.emplace(topic, &topicSubscriptions.back());
 #ifdef DEBUG
       debug_publish_subscriptions();
 #endif
@@ -43,12 +93,40 @@ class PubSub {
     bool publish(const char* topic, const char* payload, boolean retained = false, unsigned long expiresAfterMs = 0) {
       if (messageQueue.size() >= MQTT_QUEUE_MAX_SIZE) return false;
 
-      messageQueue.push(message_t(topic, payload, retained, expiresAfterMs > 0 ? millis() + expiresAfterMs : 0));
+      messageQueue.push(message_t(topic, payload, retained, expiresAfterMs > 0 ? clock_now() + CLOCK_MS(expiresAfterMs) : 0));
       return true;
     }
 
-    bool loop(unsigned long now) {
-      return mqtt_loop(now) && queue_publish(now);
+    bool loop(clock_us_t now) {
+      if (!mqtt_loop(now)) return false;
+
+      dispatch_pending(now);
+      return queue_publish(now);
+    }
+
+    // Sends straight away (no queueing, no String copies); for binary payloads
+    bool publish_now(const char* topic, const uint8_t* payload, unsigned int length, boolean retained = false) {
+      if (!pubSubClient->connected()) return false;
+
+      if (pubSubClient->publish(topic, payload, length, retained)) {
+        messages_sent++;
+        return true;
+      }
+      return false;
+    }
+
+    struct stats_t {
+      size_t queue_length;
+      unsigned long requeue_count, messages_sent, messages_received, connect_count, reconnect_count;
+      unsigned long messages_dropped, messages_coalesced, messages_expired;
+      unsigned long bytes_sent, bytes_received;
+      uint8_t protocol_version;
+      uint16_t topic_aliases;
+    };
+
+    stats_t get_stats() {
+      return stats_t { messageQueue.size(), requeue_count, messages_sent, messages_received, connect_count, reconnect_count, messages_dropped, messages_coalesced, messages_expired,
+        pubSubClient->getBytesSent(), pubSubClient->getBytesReceived(), pubSubClient->getProtocolVersion(), pubSubClient->getTopicAliasCount() };
     }
 
   private:
@@ -56,10 +134,10 @@ class PubSub {
       String topic;
       String payload;
       bool retained;
-      unsigned long expires;
+      clock_us_t expires;
       uint8_t retry_counter = 0;
 
-      message_t(const char* topic, const char* payload, boolean retained = false, unsigned long expires = 0)
+      message_t(const char* topic, const char* payload, boolean retained = false, clock_us_t expires = 0)
         : topic(topic), payload(payload), retained(retained), expires(expires)
       { }
     };
@@ -69,6 +147,28 @@ class PubSub {
       uint8_t qos;
       message_handler_t handler;
 
+      bool limited = false, pending = false;
+      rate_limit_t limit;
+      uint8_t tokens = 0;
+      clock_us_t lastRefill = 0;
+      std::vector<uint8_t> pendingPayload;
+
+      // Tops the bucket up for the time passed; true if a message may go through now
+      bool take_token(clock_us_t now) {
+        if (limit.refillMs > 0) {
+          auto refill = (now - lastRefill) / CLOCK_MS(limit.refillMs);
+          if (refill > 0) {
+            tokens = refill >= (clock_us_t)(limit.burst - tokens) ? limit.burst : tokens + refill;
+            lastRefill += refill * CLOCK_MS(limit.refillMs);
+          }
+        }
+        if (tokens == limit.burst) lastRefill = now;
+
+        if (tokens == 0) return false;
+        tokens--;
+        return true;
+      }
+
       topic_subscription_t(const char* topic, uint8_t qos, message_handler_t handler)
         : topic(topic), qos(qos), handler(handler)
       { }
@@ -78,29 +178,27 @@ class PubSub {
       { }
     };
     
-    PubSubClient *pubSubClient;
+    Client& client;
+    MqttClient *pubSubClient;
     std::queue<message_t> messageQueue;
     std::queue<message_t> requeueMessages;
     std::list<topic_subscription_t> topicSubscriptions;
-    unsigned long lastPubSubReconnectAttempt = 0;
-
-
-#ifdef DEBUG
-    unsigned long messages_sent = 0, messages_received = 0, connect_count = 0, reconnect_count = 0;
-#endif
-
-    bool reconnect(unsigned long now) {
-      if (now == 0 || now - lastPubSubReconnectAttempt > MQTT_RECONNECT_MILLIS) {
+    std::unordered_multimap<std::string, topic_subscription_t*> topicIndex; // O(1) dispatch, list keeps subscribe order
+    std::vector<topic_subscription_t*> pendingSubscriptions;
+    clock_us_t lastPubSubReconnectAttempt = 0;
+    unsigned long reconnectIntervalMs = MQTT_RECONNECT_MILLIS;
+    bool usingServerAddress = false;
+    unsigned long requeue_count = 0, messages_sent = 0, messages_received = 0, connect_count = 0, reconnect_count = 0;
+    unsigned long messages_dropped = 0, messages_coalesced = 0, messages_expired = 0;
+
+    bool reconnect(clock_us_t now) {
+      if (now == 0 || now - lastPubSubReconnectAttempt > CLOCK_MS(reconnectIntervalMs)) {
         lastPubSubReconnectAttempt = now;
-
-#ifdef DEBUG
         reconnect_count++;
-#endif
 
         if (pubSubClient->connect(MQTT_CLIENT_ID, MQTT_USERNAME, MQTT_PASSWORD, MQTT_STATUS_TOPIC, MQTTQOS0, true, MQTT_STATUS_OFFLINE_MSG, true)) {
-#ifdef DEBUG
           connect_count++;
-#endif
+          TRACE(TRACE_MQTT_CONNECT, 1, reconnect_count);
           pubSubClient->publish(MQTT_STATUS_TOPIC, MQTT_STATUS_ONLINE_MSG, true);
 
 #ifdef VERSION
@@ -116,6 +214,10 @@ class PubSub {
           debug_publish_subscriptions();
 #endif
         }
+        else if (usingServerAddress) {
+          usingServerAddress = false;
+          pubSubClient->setServer(MQTT_SERVER_NAME, MQTT_SERVER_PORT);
+        }
         
         return pubSubClient->connected();
       }
@@ -124,53 +226,88 @@ class PubSub {
     }
 
     void mqtt_on_message(char* topic, uint8_t* payload, unsigned int length) {
-#ifdef DEBUG
       messages_received++;
-#endif
 
-      for (auto& s : topicSubscriptions) {
-        if (s.topic.equals(topic)) {
-          s.handler(payload, length);
+      auto range = topicIndex.equal_range(topic);
+      TRACE(TRACE_MQTT_MESSAGE, length, std::distance(range.first, range.second));
+      for (auto it = range.first; it != range.second; ++it) {
+        auto s = it->second;
+
+        if (!s->limited) {
+          s->handler(payload, length);
+        }
+        else if (s->limit.bypass && s->limit.bypass(payload, length)) {
+          drop_pending(s);
+          s->handler(payload, length);
+        }
+        else if (s->limit.coalesce) {
+          if (s->pending) messages_coalesced++;
+          else pendingSubscriptions.push_back(s);
+
+          s->pending = true;
+          s->pendingPayload.assign(payload, payload + length);
+        }
+        else if (s->take_token(clock_now())) {
+          s->handler(payload, length);
+        }
+        else {
+          messages_dropped++;
+          TRACE(TRACE_MQTT_DROPPED, messages_dropped, messages_coalesced);
+        }
+      }
+    }
+
+    void drop_pending(topic_subscription_t* s) {
+      if (!s->pending) return;
+
+      s->pending = false;
+      pendingSubscriptions.erase(std::find(pendingSubscriptions.begin(), pendingSubscriptions.end(), s));
+      messages_coalesced++;
+    }
+
+    // Hands the latest held message of each coalescing topic over, if its bucket allows
+    void dispatch_pending(clock_us_t now) {
+      for (size_t i = 0; i < pendingSubscriptions.size(); ) {
+        auto s = pendingSubscriptions[i];
+
+        if (!s->take_token(now)) {
+          i++;
+          continue;
         }
+
+        s->pending = false;
+        pendingSubscriptions.erase(pendingSubscriptions.begin() + i);
+        s->handler(s->pendingPayload.data(), s->pendingPayload.size());
       }
     }
 
-    bool queue_publish(unsigned long now) {
+    bool queue_publish(clock_us_t now) {
       bool result = true;
       if (messageQueue.size() == 0) return true;
 
-#ifdef DEBUG
-      pubSubClient->publish(MQTT_PATH_PREFIX "/debug/pubsub/queue_length", String(messageQueue.size()).c_str());
-#endif
-
       while (!messageQueue.empty()) {
         auto m = messageQueue.front();
         messageQueue.pop();
 
-        if (m.expires == 0 || (m.expires > 0 && m.expires < now)) {
-          if (pubSubClient->publish(m.topic.c_str(), m.payload.c_str(), m.retained)) {
-            result &= true;
-#ifdef DEBUG
-            messages_sent++;
-#endif
-          }
-          else {
-            result &= false;
-            if (m.retry_counter++ < 3) {
-              requeueMessages.push(m);
-            }
+        // Stale by now, e.g. queued while offline: drop instead of publishing
+        if (m.expires > 0 && now >= m.expires) {
+          messages_expired++;
+          continue;
+        }
+
+        if (pubSubClient->publish(m.topic.c_str(), m.payload.c_str(), m.retained)) {
+          result &= true;
+          messages_sent++;
+        }
+        else {
+          result &= false;
+          if (m.retry_counter++ < 3) {
+            requeueMessages.push(m);
+            requeue_count++;
           }
         }
       }
 
-#ifdef DEBUG
-      pubSubClient->publish(MQTT_PATH_PREFIX "/debug/pubsub/requeue_count", String(requeueMessages.size()).c_str());
-      pubSubClient->publish(MQTT_PATH_PREFIX "/debug/pubsub/messages_sent", String(messages_sent).c_str());
-      pubSubClient->publish(MQTT_PATH_PREFIX "/debug/pubsub/messages_received", String(messages_received).c_str());
-      pubSubClient->publish(MQTT_PATH_PREFIX "/debug/pubsub/connect_count", String(connect_count).c_str());
-      pubSubClient->publish(MQTT_PATH_PREFIX "/debug/pubsub/reconnect_count", String(reconnect_count).c_str());
-#endif
-
       while (!requeueMessages.empty()) {
         messageQueue.push(requeueMessages.front());
         requeueMessages.pop();
@@ -179,12 +316,18 @@ class PubSub {
       return result;
     }
 
-    bool mqtt_loop(unsigned long now) {
+    bool mqtt_loop(clock_us_t now) {
       if (!pubSubClient->connected() && !reconnect(now)) {
         return false;
       }
 
-      return pubSubClient->loop();
+      // Drain whatever arrived since the last pass so bursts coalesce within one loop
+      bool result = pubSubClient->loop();
+      for (uint8_t n = 1; result && n < MQTT_MAX_PACKETS_PER_LOOP && client.available() > 0; n++) {
+        result = pubSubClient->loop();
+      }
+
+      return result;
     }
 
 #ifdef DEBUG
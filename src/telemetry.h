@@ -0,0 +1,68 @@
+#ifndef __TELEMETRY_H
+#define __TELEMETRY_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "app.h"
+#include "pubsub.h"
+
+// Collects PubSub counters, heap and loop timing into one MessagePack snapshot
+// published to <prefix>/telemetry every TELEMETRY_INTERVAL_MILLIS
+class Telemetry {
+  public:
+    Telemetry(PubSub& pubsub) : pubsub(pubsub)
+    { }
+
+    // Busy time of one loop pass (excluding power-save idle)
+    void recordLoop(unsigned long busyUs) {
+      loopCount++;
+      loopBusyTotalUs += busyUs;
+      if (busyUs > loopBusyMaxUs) loopBusyMaxUs = busyUs;
+    }
+
+    void loop(clock_us_t now) {
+      if (now - lastPublish < CLOCK_MS(TELEMETRY_INTERVAL_MILLIS)) return;
+      lastPublish = now;
+
+      auto stats = pubsub.get_stats();
+
+      StaticJsonDocument<512> doc;
+      doc["uptime_ms"] = CLOCK_TO_MS(now);
+      doc["heap_free"] = ESP.getFreeHeap();
+      doc["heap_min"] = ESP.getMinFreeHeap();
+      doc["heap_max_alloc"] = ESP.getMaxAllocHeap();
+      doc["mqtt_queue"] = stats.queue_length;
+      doc["mqtt_requeued"] = stats.requeue_count;
+      doc["mqtt_sent"] = stats.messages_sent;
+      doc["mqtt_received"] = stats.messages_received;
+      doc["mqtt_connects"] = stats.connect_count;
+      doc["mqtt_reconnects"] = stats.reconnect_count;
+      doc["mqtt_dropped"] = stats.messages_dropped;
+      doc["mqtt_coalesced"] = stats.messages_coalesced;
+      doc["mqtt_expired"] = stats.messages_expired;
+      doc["mqtt_bytes_out"] = stats.bytes_sent;
+      doc["mqtt_bytes_in"] = stats.bytes_received;
+      doc["mqtt_protocol"] = stats.protocol_version;
+      doc["mqtt_aliases"] = stats.topic_aliases;
+      doc["loop_count"] = loopCount;
+      doc["loop_avg_us"] = loopCount > 0 ? (unsigned long)(loopBusyTotalUs / loopCount) : 0;
+      doc["loop_max_us"] = loopBusyMaxUs;
+
+      uint8_t buffer[TELEMETRY_BUFFER_SIZE];
+      size_t length = serializeMsgPack(doc, buffer, sizeof(buffer));
+
+      if (pubsub.publish_now(MQTT_PATH_PREFIX "/telemetry", buffer, length)) {
+        loopCount = 0;
+        loopBusyTotalUs = 0;
+        loopBusyMaxUs = 0;
+      }
+    }
+
+  private:
+    PubSub& pubsub;
+    clock_us_t lastPublish = 0;
+    unsigned long loopCount = 0, loopBusyMaxUs = 0;
+    uint64_t loopBusyTotalUs = 0;
+};
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef __TRACE_OUTPUT_H
+#define __TRACE_OUTPUT_H
+
+#include <Arduino.h>
+#include <Trace.h>
+#include "app.h"
+#include "pubsub.h"
+
+// Moves trace records out of the ring in loop idle time, as binary frames:
+// raw on Serial (TRACE_OUTPUT_SERIAL) or batched to <prefix>/trace (TRACE_OUTPUT_MQTT).
+// Decode with tools/trace_decode.py.
+class TraceOutput {
+  public:
+    TraceOutput(PubSub& pubsub) : pubsub(pubsub)
+    { }
+
+    void begin() {
+#if TRACE_OUTPUT == TRACE_OUTPUT_SERIAL
+      Serial.begin(TRACE_SERIAL_BAUD);
+#endif
+    }
+
+    void loop(clock_us_t now) {
+#if TRACE_OUTPUT == TRACE_OUTPUT_SERIAL
+      // Only what fits into the UART TX buffer, never block the loop on the console
+      int room = Serial.availableForWrite();
+      if (room < (int)(TRACE_FRAME_HEADER_SIZE + sizeof(trace_record_t))) return;
+
+      size_t length = traceRing.drainFrame(frame, min((size_t)room, sizeof(frame)));
+      if (length > 0) Serial.write(frame, length);
+#elif TRACE_OUTPUT == TRACE_OUTPUT_MQTT
+      // Records stay in the ring while offline, the dropped counter tells about overflow
+      if (now - lastFlush < CLOCK_MS(TRACE_FLUSH_MILLIS) || !pubsub.connected()) return;
+      lastFlush = now;
+
+      size_t length = traceRing.drainFrame(frame, sizeof(frame));
+      if (length > 0) pubsub.publish_now(MQTT_PATH_PREFIX "/trace", frame, length);
+#endif
+    }
+
+  private:
+    PubSub& pubsub;
+    clock_us_t lastFlush = 0;
+    uint8_t frame[TRACE_FRAME_HEADER_SIZE + TRACE_FRAME_RECORDS * sizeof(trace_record_t)];
+};
+
+#endif
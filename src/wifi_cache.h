@@ -0,0 +1,189 @@
+#ifndef __WIFI_CACHE_H
+#define __WIFI_CACHE_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <esp_wifi.h>
+#include <Preferences.h>
+#include <esp_attr.h>
+#include <rom/crc.h>
+#include <Clock.h>
+#include "app.h"
+
+#define WIFI_CACHE_MAGIC              0x57494643  // "WIFC"
+#define WIFI_CACHE_PREFS_KEY          "wifi_cache"
+
+#define WIFI_CONNECT_FULL             0
+#define WIFI_CONNECT_FAST             1   // cached channel/BSSID, DHCP
+#define WIFI_CONNECT_FAST_STATIC      2   // cached channel/BSSID and IP configuration, no DHCP
+
+#ifndef WIFI_STATIC_LEASE_MAX_AGE_SEC
+#define WIFI_STATIC_LEASE_MAX_AGE_SEC 3600  // reuse a DHCP address without DHCP for at most this long after it was leased
+#endif
+
+struct wifi_cache_t {
+  uint32_t magic;
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint32_t ip, gateway, subnet, dns, broker;
+  uint32_t leasedAt;                      // Unix time DHCP handed out `ip`, 0 if unknown (clock not synced)
+  uint32_t crc;
+};
+
+// Survives software and watchdog resets, garbage after power-on (hence magic + CRC)
+RTC_NOINIT_ATTR wifi_cache_t rtcWifiCache;
+
+typedef std::function<void()> WifiConfigureCallback;
+
+class WifiCache {
+  public:
+    // Called once WiFi.begin() has written the station config, right before associating
+    void onConfigure(WifiConfigureCallback cb) {
+      configureCb = cb;
+    }
+
+    // Starts the connection: RTC cache (warm restart) reuses the whole IP configuration while
+    // the DHCP lease is recent (system time survives warm restarts), otherwise the cache
+    // only skips the scan and DHCP runs as usual
+    uint8_t begin(Preferences& prefs) {
+      preferences = &prefs;
+
+      if (isValid(rtcWifiCache) && isLeaseRecent(rtcWifiCache)) {
+        cache = rtcWifiCache;
+        connectMode = WIFI_CONNECT_FAST_STATIC;
+        WiFi.config(IPAddress(cache.ip), IPAddress(cache.gateway), IPAddress(cache.subnet), IPAddress(cache.dns));
+      }
+      else if (isValid(rtcWifiCache)) {
+        cache = rtcWifiCache;
+        connectMode = WIFI_CONNECT_FAST;
+      }
+      else if (prefs.getBytes(WIFI_CACHE_PREFS_KEY, &cache, sizeof(cache)) == sizeof(cache) && isValid(cache)) {
+        connectMode = WIFI_CONNECT_FAST;
+      }
+      else {
+        memset(&cache, 0, sizeof(cache));
+        connectMode = WIFI_CONNECT_FULL;
+      }
+
+      connectStart = clock_now();
+      if (connectMode == WIFI_CONNECT_FULL) connect();
+      else connect(cache.channel, cache.bssid);
+
+      return connectMode;
+    }
+
+    // Falls back to a full scan + DHCP when the fast path doesn't connect in time,
+    // and goes back to DHCP once a reused static address gets too old
+    void loop(clock_us_t now, bool connected) {
+      if (connected && connectedAt == 0) connectedAt = now;
+
+      // Lease time wasn't known when stored (SNTP not synced yet): record it once it is
+      if (leasePending && connected && connectedAt > 0 && clock_to_epoch_us(connectedAt) > 0) {
+        leasePending = false;
+        store();
+      }
+
+      if (connectMode == WIFI_CONNECT_FAST_STATIC && fastPathDone && !isLeaseRecent(cache)) {
+        connectMode = WIFI_CONNECT_FAST;
+        connectedAt = 0;
+        leasePending = true;    // store the new lease once DHCP is done
+
+        WiFi.disconnect();
+        WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0), IPAddress((uint32_t)0));
+        connect(cache.channel, cache.bssid);
+        return;
+      }
+
+      if (connectMode == WIFI_CONNECT_FULL || fastPathDone) return;
+
+      if (connected) {
+        fastPathDone = true;
+      }
+      else if (now - connectStart > CLOCK_MS(WIFI_FAST_CONNECT_TIMEOUT_MILLIS)) {
+        fastPathDone = true;
+        connectMode = WIFI_CONNECT_FULL;
+        invalidate();
+
+        WiFi.disconnect();
+        WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0), IPAddress((uint32_t)0));
+        connect();
+      }
+    }
+
+    uint8_t getConnectMode() {
+      return connectMode;
+    }
+
+    // Broker address from the cache, 0 if unknown
+    IPAddress getBrokerAddress() {
+      return IPAddress(cache.broker);
+    }
+
+    // Captures the current link; writes NVS only when something changed
+    void store() {
+      wifi_cache_t current;
+      memset(&current, 0, sizeof(current));
+      current.magic = WIFI_CACHE_MAGIC;
+      memcpy(current.bssid, WiFi.BSSID(), sizeof(current.bssid));
+      current.channel = WiFi.channel();
+      current.ip = WiFi.localIP();
+      current.gateway = WiFi.gatewayIP();
+      current.subnet = WiFi.subnetMask();
+      current.dns = WiFi.dnsIP();
+
+      // Only DHCP renews the lease, a reused static address keeps its original lease time
+      if (connectMode == WIFI_CONNECT_FAST_STATIC && current.ip == cache.ip) {
+        current.leasedAt = cache.leasedAt;
+      }
+      else {
+        current.leasedAt = (uint32_t)(clock_to_epoch_us(connectedAt > 0 ? connectedAt : clock_now()) / 1000000LL);
+        leasePending = current.leasedAt == 0;
+      }
+
+      IPAddress broker;
+      current.broker = WiFi.hostByName(MQTT_SERVER_NAME, broker) == 1 ? (uint32_t)broker : cache.broker;
+      current.crc = crc(current);
+
+      rtcWifiCache = current;
+      if (memcmp(&current, &cache, sizeof(current)) != 0) {
+        cache = current;
+        preferences->putBytes(WIFI_CACHE_PREFS_KEY, &cache, sizeof(cache));
+      }
+    }
+
+    void invalidate() {
+      rtcWifiCache.magic = 0;
+      cache.broker = 0;
+      preferences->remove(WIFI_CACHE_PREFS_KEY);
+    }
+
+  private:
+    Preferences* preferences = NULL;
+    wifi_cache_t cache;
+    uint8_t connectMode = WIFI_CONNECT_FULL;
+    bool fastPathDone = false, leasePending = false;
+    clock_us_t connectStart = 0, connectedAt = 0;
+    WifiConfigureCallback configureCb = NULL;
+
+    // Writes the station config without associating, lets the callback amend it, then associates once
+    void connect(int32_t channel = 0, const uint8_t* bssid = NULL) {
+      WiFi.begin(WIFI_SSID, WIFI_PASSPHRASE, channel, bssid, false);
+      if (configureCb != NULL) configureCb();
+      esp_wifi_connect();
+    }
+
+    static uint32_t crc(const wifi_cache_t& c) {
+      return crc32_le(0, (const uint8_t*)&c, offsetof(wifi_cache_t, crc));
+    }
+
+    static bool isValid(const wifi_cache_t& c) {
+      return c.magic == WIFI_CACHE_MAGIC && c.channel > 0 && c.crc == crc(c);
+    }
+
+    static bool isLeaseRecent(const wifi_cache_t& c) {
+      int64_t now = clock_to_epoch_us(clock_now()) / 1000000LL;
+      return c.leasedAt > 0 && now >= c.leasedAt && now - c.leasedAt < WIFI_STATIC_LEASE_MAX_AGE_SEC;
+    }
+};
+
+#endif
@@ -0,0 +1,36 @@
+# Pre-build script of [env:native]: compresses a few inputs with build/compress_firmware.py
+# so test/test_heatshrink round-trips the decoder against the real encoder.
+#   <build dir>/heatshrink_fixtures/<input>.bin          original
+#   <build dir>/heatshrink_fixtures/<input>_w<W>_l<L>.hs  compressed image (HSF1 header + stream)
+
+import os
+import random
+import sys
+
+Import("env")
+
+SETTINGS = [(8, 4), (10, 5), (12, 6)]
+
+project_dir = env.subst("$PROJECT_DIR")
+fixture_dir = os.path.join(env.subst("$BUILD_DIR"), "heatshrink_fixtures")
+sys.path.insert(0, os.path.join(project_dir, "build"))
+
+from compress_firmware import compress_image
+
+def inputs():
+  rnd = random.Random(28)
+  yield "random", bytes(rnd.getrandbits(8) for _ in range(8192))
+
+  words = [b"blinds", b"relay", b"state", b"FullUp", b"RollingDown", b"mqtt", b"\x00\x00\x00\x00", b"\xff\xff"]
+  yield "synthetic", b"".join(rnd.choice(words) for _ in range(6000))
+
+  # A real ELF (the interpreter running this script) stands in for a firmware image
+  with open(os.path.realpath(sys.executable), "rb") as f: yield "elf", f.read(48 * 1024)
+
+os.makedirs(fixture_dir, exist_ok=True)
+for name, data in inputs():
+  with open(os.path.join(fixture_dir, name + ".bin"), "wb") as f: f.write(data)
+  for w, l in SETTINGS:
+    with open(os.path.join(fixture_dir, "{}_w{}_l{}.hs".format(name, w, l)), "wb") as f: f.write(compress_image(data, w, l))
+
+env.Append(CPPDEFINES=[("HEATSHRINK_FIXTURE_DIR", env.StringifyMacro(fixture_dir))])
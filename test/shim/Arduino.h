@@ -0,0 +1,52 @@
+// Host stand-ins for the parts of the Arduino core and ESP-IDF that src/ota_mqtt.h uses,
+// for the [env:native] tests (see test/test_ota_mqtt)
+#ifndef ARDUINO_SHIM_H
+#define ARDUINO_SHIM_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define IRAM_ATTR
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+class String {
+  public:
+    String(const char* text = "") : text(text) { }
+    String(int value) : text(std::to_string(value)) { }
+    String(unsigned int value) : text(std::to_string(value)) { }
+    String(long value) : text(std::to_string(value)) { }
+    String(unsigned long value) : text(std::to_string(value)) { }
+
+    void concat(const char* s) { text += s; }
+    void concat(const String& s) { text += s.text; }
+    void concat(unsigned long value) { text += std::to_string(value); }
+    const char* c_str() const { return text.c_str(); }
+    unsigned int length() const { return text.size(); }
+    bool operator==(const char* s) const { return text == s; }
+
+  private:
+    std::string text;
+};
+
+inline unsigned long millis() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline void delay(unsigned long ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+inline void yield() {
+  std::this_thread::yield();
+}
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef PREFERENCES_SHIM_H
+#define PREFERENCES_SHIM_H
+
+#include <Arduino.h>
+#include <map>
+#include <string>
+#include <vector>
+
+// NVS in RAM; shared by all instances so a new MqttOta sees what the previous one persisted, as after a restart
+class Preferences {
+  public:
+    static std::map<std::string, std::vector<uint8_t>>& store() {
+      static std::map<std::string, std::vector<uint8_t>> values;
+      return values;
+    }
+
+    bool begin(const char* name, bool readOnly = false) { return true; }
+    void end() { }
+
+    size_t putBytes(const char* key, const void* value, size_t length) {
+      store()[key].assign((const uint8_t*)value, (const uint8_t*)value + length);
+      return length;
+    }
+
+    size_t getBytes(const char* key, void* buf, size_t maxLength) {
+      auto it = store().find(key);
+      if (it == store().end() || it->second.size() > maxLength) return 0;
+      memcpy(buf, it->second.data(), it->second.size());
+      return it->second.size();
+    }
+
+    size_t putULong(const char* key, uint32_t value) {
+      return putBytes(key, &value, sizeof(value));
+    }
+
+    uint32_t getULong(const char* key, uint32_t defaultValue = 0) {
+      uint32_t value;
+      return getBytes(key, &value, sizeof(value)) == sizeof(value) ? value : defaultValue;
+    }
+
+    bool isKey(const char* key) {
+      return store().count(key) > 0;
+    }
+
+    bool remove(const char* key) {
+      return store().erase(key) > 0;
+    }
+};
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef ESP_OTA_OPS_SHIM_H
+#define ESP_OTA_OPS_SHIM_H
+
+#include <esp_partition.h>
+
+// The partition an update goes to, and the one set to boot next; both owned by the test
+inline esp_partition_t& ota_shim_update_partition() {
+  static esp_partition_t partition = { 0x110000, 64 * 1024, std::vector<uint8_t>(64 * 1024, 0xff), false };
+  return partition;
+}
+
+inline const esp_partition_t*& ota_shim_boot_partition() {
+  static const esp_partition_t* partition = NULL;
+  return partition;
+}
+
+inline const esp_partition_t* esp_ota_get_next_update_partition(const esp_partition_t* start) {
+  return &ota_shim_update_partition();
+}
+
+inline esp_err_t esp_ota_set_boot_partition(const esp_partition_t* partition) {
+  ota_shim_boot_partition() = partition;
+  return ESP_OK;
+}
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef ESP_PARTITION_SHIM_H
+#define ESP_PARTITION_SHIM_H
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+typedef int esp_err_t;
+#define ESP_OK                        0
+#define ESP_FAIL                      -1
+
+// Flash of one partition in RAM; writes only clear bits, like NOR flash, so writing an unerased sector shows up
+struct esp_partition_t {
+  uint32_t address;
+  uint32_t size;
+  std::vector<uint8_t> flash;
+  bool failWrites;
+};
+
+inline esp_err_t esp_partition_erase_range(const esp_partition_t* p, size_t offset, size_t length) {
+  if (offset % 4096 != 0 || offset + length > p->size) return ESP_FAIL;
+  memset(const_cast<esp_partition_t*>(p)->flash.data() + offset, 0xff, length);
+  return ESP_OK;
+}
+
+inline esp_err_t esp_partition_write(const esp_partition_t* p, size_t offset, const void* data, size_t length) {
+  if (p->failWrites || offset + length > p->size) return ESP_FAIL;
+  auto flash = const_cast<esp_partition_t*>(p)->flash.data() + offset;
+  for (size_t i = 0; i < length; i++) flash[i] &= ((const uint8_t*)data)[i];
+  return ESP_OK;
+}
+
+inline esp_err_t esp_partition_read(const esp_partition_t* p, size_t offset, void* data, size_t length) {
+  if (offset + length > p->size) return ESP_FAIL;
+  memcpy(data, p->flash.data() + offset, length);
+  return ESP_OK;
+}
+
+#endif
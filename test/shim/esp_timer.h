@@ -0,0 +1,11 @@
+#ifndef ESP_TIMER_SHIM_H
+#define ESP_TIMER_SHIM_H
+
+#include <stdint.h>
+#include <chrono>
+
+inline int64_t esp_timer_get_time() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef FREERTOS_SHIM_H
+#define FREERTOS_SHIM_H
+
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+typedef uint32_t UBaseType_t;
+
+#define pdTRUE                        1
+#define pdFALSE                       0
+#define pdPASS                        1
+#define portMAX_DELAY                 0xffffffffUL
+#define pdMS_TO_TICKS(ms)             ((TickType_t)(ms))
+
+// Queues and counting semaphores on std::condition_variable, ticks are milliseconds
+struct shim_queue_t {
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::deque<std::vector<uint8_t>> items;
+  size_t itemSize, capacity;
+
+  // Blocks until `ready` holds or the ticks are up
+  template<class P> bool wait(std::unique_lock<std::mutex>& lock, TickType_t ticks, P ready) {
+    if (ticks == portMAX_DELAY) {
+      changed.wait(lock, ready);
+      return true;
+    }
+    return changed.wait_for(lock, std::chrono::milliseconds(ticks), ready);
+  }
+};
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef FREERTOS_QUEUE_SHIM_H
+#define FREERTOS_QUEUE_SHIM_H
+
+#include <freertos/FreeRTOS.h>
+#include <string.h>
+
+typedef shim_queue_t* QueueHandle_t;
+
+inline QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+  auto q = new shim_queue_t();
+  q->itemSize = itemSize;
+  q->capacity = length;
+  return q;
+}
+
+inline BaseType_t xQueueSend(QueueHandle_t q, const void* item, TickType_t ticks) {
+  std::unique_lock<std::mutex> lock(q->mutex);
+  if (!q->wait(lock, ticks, [q]() { return q->items.size() < q->capacity; })) return pdFALSE;
+  q->items.emplace_back((const uint8_t*)item, (const uint8_t*)item + q->itemSize);
+  q->changed.notify_all();
+  return pdTRUE;
+}
+
+inline BaseType_t xQueueReceive(QueueHandle_t q, void* item, TickType_t ticks) {
+  std::unique_lock<std::mutex> lock(q->mutex);
+  if (!q->wait(lock, ticks, [q]() { return !q->items.empty(); })) return pdFALSE;
+  memcpy(item, q->items.front().data(), q->itemSize);
+  q->items.pop_front();
+  q->changed.notify_all();
+  return pdTRUE;
+}
+
+#endif
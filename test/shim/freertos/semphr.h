@@ -0,0 +1,33 @@
+#ifndef FREERTOS_SEMPHR_SHIM_H
+#define FREERTOS_SEMPHR_SHIM_H
+
+#include <freertos/FreeRTOS.h>
+
+// A counting semaphore is a queue of empty items, as in FreeRTOS
+typedef shim_queue_t* SemaphoreHandle_t;
+
+inline SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t maxCount, UBaseType_t initialCount) {
+  auto s = new shim_queue_t();
+  s->itemSize = 0;
+  s->capacity = maxCount;
+  s->items.resize(initialCount);
+  return s;
+}
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t ticks) {
+  std::unique_lock<std::mutex> lock(s->mutex);
+  if (!s->wait(lock, ticks, [s]() { return !s->items.empty(); })) return pdFALSE;
+  s->items.pop_front();
+  s->changed.notify_all();
+  return pdTRUE;
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t s) {
+  std::unique_lock<std::mutex> lock(s->mutex);
+  if (s->items.size() >= s->capacity) return pdFALSE;
+  s->items.emplace_back();
+  s->changed.notify_all();
+  return pdTRUE;
+}
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef FREERTOS_TASK_SHIM_H
+#define FREERTOS_TASK_SHIM_H
+
+#include <freertos/FreeRTOS.h>
+
+typedef std::thread* TaskHandle_t;
+typedef void (*TaskFunction_t)(void*);
+
+// Tasks never return in the firmware: the thread is detached and lives until the test process exits
+inline BaseType_t xTaskCreate(TaskFunction_t task, const char* name, uint32_t stackDepth, void* arg, UBaseType_t priority, TaskHandle_t* handle) {
+  auto thread = new std::thread(task, arg);
+  thread->detach();
+  if (handle != NULL) *handle = thread;
+  return pdPASS;
+}
+
+#endif
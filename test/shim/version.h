@@ -0,0 +1 @@
+#define VERSION "native"
@@ -0,0 +1,138 @@
+#include <unity.h>
+#include <HeatshrinkDecoder.h>
+#include <chrono>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Fixtures are generated by test/generate_heatshrink_fixtures.py with build/compress_firmware.py
+#ifndef HEATSHRINK_FIXTURE_DIR
+#error "HEATSHRINK_FIXTURE_DIR not set, run through `pio test -e native`"
+#endif
+
+static const uint8_t SETTINGS[][2] = { { 8, 4 }, { 10, 5 }, { 12, 6 } };
+static const size_t FEED_SIZES[] = { 1, 7, 1024 };
+
+static HeatshrinkDecoder<12, 256> decoder;
+
+static std::vector<uint8_t> readFile(const std::string& name) {
+  std::vector<uint8_t> data;
+  FILE* f = fopen((std::string(HEATSHRINK_FIXTURE_DIR "/") + name).c_str(), "rb");
+  TEST_ASSERT_NOT_NULL_MESSAGE(f, name.c_str());
+
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) data.insert(data.end(), buf, buf + n);
+  fclose(f);
+  return data;
+}
+
+static std::string imageName(const char* input, uint8_t w, uint8_t l) {
+  char name[64];
+  snprintf(name, sizeof(name), "%s_w%u_l%u.hs", input, w, l);
+  return name;
+}
+
+// Decodes a whole image fed `feed` bytes at a time, the way HttpOta hands over HTTP reads
+static std::vector<uint8_t> decodeImage(const std::vector<uint8_t>& image, size_t feed) {
+  heatshrink_image_header_t header;
+  TEST_ASSERT_TRUE(image.size() >= HEATSHRINK_IMAGE_HEADER_SIZE);
+  TEST_ASSERT_TRUE(header.parse(image.data()));
+  TEST_ASSERT_TRUE(decoder.reset(header.windowBits, header.lookaheadBits, header.size));
+
+  std::vector<uint8_t> out;
+  auto sink = [&out](const uint8_t* data, size_t length) { out.insert(out.end(), data, data + length); return true; };
+
+  for (size_t pos = HEATSHRINK_IMAGE_HEADER_SIZE; pos < image.size() && !decoder.isComplete(); pos += feed) {
+    size_t n = image.size() - pos < feed ? image.size() - pos : feed;
+    TEST_ASSERT_TRUE(decoder.decode(image.data() + pos, n, sink));
+  }
+  TEST_ASSERT_TRUE(decoder.flush(sink));
+  TEST_ASSERT_TRUE(decoder.isComplete());
+  TEST_ASSERT_EQUAL_UINT32(header.size, out.size());
+  return out;
+}
+
+static void roundTrip(const char* input) {
+  auto original = readFile(std::string(input) + ".bin");
+
+  for (auto& s : SETTINGS) {
+    auto image = readFile(imageName(input, s[0], s[1]));
+    for (auto feed : FEED_SIZES) {
+      char message[64];
+      snprintf(message, sizeof(message), "%s w=%u l=%u feed=%u", input, s[0], s[1], (unsigned)feed);
+
+      auto decoded = decodeImage(image, feed);
+      TEST_ASSERT_EQUAL_UINT32_MESSAGE(original.size(), decoded.size(), message);
+      TEST_ASSERT_EQUAL_MEMORY_MESSAGE(original.data(), decoded.data(), original.size(), message);
+    }
+  }
+}
+
+void test_round_trip_random() {
+  roundTrip("random");
+}
+
+void test_round_trip_synthetic() {
+  roundTrip("synthetic");
+}
+
+void test_round_trip_elf() {
+  roundTrip("elf");
+}
+
+void test_rejects_unsupported_parameters() {
+  TEST_ASSERT_FALSE(decoder.reset(13, 6));   // window larger than the decoder's buffer
+  TEST_ASSERT_FALSE(decoder.reset(3, 2));
+  TEST_ASSERT_FALSE(decoder.reset(10, 10));
+}
+
+void test_sink_abort() {
+  auto image = readFile(imageName("synthetic", 10, 5));
+  heatshrink_image_header_t header;
+  TEST_ASSERT_TRUE(header.parse(image.data()));
+  decoder.reset(header.windowBits, header.lookaheadBits, header.size);
+
+  auto sink = [](const uint8_t*, size_t) { return false; };
+  TEST_ASSERT_FALSE(decoder.decode(image.data() + HEATSHRINK_IMAGE_HEADER_SIZE, image.size() - HEATSHRINK_IMAGE_HEADER_SIZE, sink));
+}
+
+// Host throughput of the firmware's settings (w=10 l=5) with OTA-sized feeds; informational only
+void test_benchmark_throughput() {
+  auto image = readFile(imageName("elf", 10, 5));
+  size_t decoded = 0;
+  auto sink = [&decoded](const uint8_t*, size_t length) { decoded += length; return true; };
+
+  auto start = std::chrono::steady_clock::now();
+  int runs = 0;
+  do {
+    heatshrink_image_header_t header;
+    TEST_ASSERT_TRUE(header.parse(image.data()));
+    decoder.reset(header.windowBits, header.lookaheadBits, header.size);
+    for (size_t pos = HEATSHRINK_IMAGE_HEADER_SIZE; pos < image.size(); pos += 1024) {
+      decoder.decode(image.data() + pos, image.size() - pos < 1024 ? image.size() - pos : 1024, sink);
+    }
+    decoder.flush(sink);
+    runs++;
+  } while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(500));
+
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  char message[96];
+  snprintf(message, sizeof(message), "heatshrink w=10 l=5: %.1f MB/s decoded (%d runs, %u bytes)", decoded / seconds / 1e6, runs, (unsigned)decoded);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_TRUE(decoded > 0);
+}
+
+void setUp() { }
+void tearDown() { }
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_round_trip_random);
+  RUN_TEST(test_round_trip_synthetic);
+  RUN_TEST(test_round_trip_elf);
+  RUN_TEST(test_rejects_unsupported_parameters);
+  RUN_TEST(test_sink_abort);
+  RUN_TEST(test_benchmark_throughput);
+  return UNITY_END();
+}
@@ -0,0 +1,264 @@
+#include <unity.h>
+#include <app.h>
+#include <Preferences.h>
+#include <esp_ota_ops.h>
+#include <mbedtls/sha256.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Broker stand-in in place of src/pubsub.h: records what MqttOta publishes and how
+#define __PUBSUB_H
+class PubSub {
+  public:
+    struct message_t {
+      std::string topic, payload;
+      bool immediate;
+    };
+
+    std::vector<message_t> messages;
+    bool connected = true;
+
+    bool publish(const char* topic, const char* payload, bool retained = false) {
+      messages.push_back(message_t { topic, payload, false });
+      return true;
+    }
+
+    bool publish_now(const char* topic, const uint8_t* payload, unsigned int length, bool retained = false) {
+      if (!connected) return false;
+      messages.push_back(message_t { topic, std::string((const char*)payload, length), true });
+      return true;
+    }
+
+    // Latest payload on <prefix>/ota/<name>, empty if none
+    std::string last(const char* name, bool* immediate = NULL) {
+      std::string topic = std::string(MQTT_PATH_PREFIX "/ota/") + name;
+      for (auto it = messages.rbegin(); it != messages.rend(); ++it) {
+        if (it->topic != topic) continue;
+        if (immediate != NULL) *immediate = it->immediate;
+        return it->payload;
+      }
+      return "";
+    }
+
+    int progress() {
+      auto p = last("progress");
+      return p.empty() ? -1 : atoi(p.c_str());
+    }
+};
+
+#include <ota_mqtt.h>
+
+#define CHUNK_SIZE                    1024
+#define IMAGE_SIZE                    (3 * OTA_MQTT_SECTOR_SIZE + 2 * CHUNK_SIZE + 300)  // short last chunk
+#define IMAGE_CHUNKS                  ((IMAGE_SIZE + CHUNK_SIZE - 1) / CHUNK_SIZE)
+
+static std::vector<uint8_t> image;
+static PubSub* pubsub;
+static Preferences preferences;
+static MqttOta* ota;
+
+static std::string beginPayload(const std::vector<uint8_t>& data) {
+  mbedtls_sha256_context ctx;
+  uint8_t sha[32];
+  mbedtls_sha256_init(&ctx);
+  mbedtls_sha256_starts_ret(&ctx, 0);
+  mbedtls_sha256_update_ret(&ctx, data.data(), data.size());
+  mbedtls_sha256_finish_ret(&ctx, sha);
+
+  char text[96];
+  int n = snprintf(text, sizeof(text), "%u %u ", (unsigned)data.size(), CHUNK_SIZE);
+  for (int i = 0; i < 32; i++) n += snprintf(text + n, sizeof(text) - n, "%02x", sha[i]);
+  return text;
+}
+
+static void begin(const std::vector<uint8_t>& data = image) {
+  auto payload = beginPayload(data);
+  ota->onBegin((uint8_t*)payload.data(), payload.size());
+}
+
+static void chunk(uint32_t index, const std::vector<uint8_t>& data = image) {
+  std::vector<uint8_t> payload = { (uint8_t)index, (uint8_t)(index >> 8), (uint8_t)(index >> 16), (uint8_t)(index >> 24) };
+  size_t offset = index * CHUNK_SIZE;
+  size_t length = data.size() - offset < CHUNK_SIZE ? data.size() - offset : CHUNK_SIZE;
+  payload.insert(payload.end(), data.begin() + offset, data.begin() + offset + length);
+  ota->onChunk(payload.data(), payload.size());
+}
+
+// Runs the main loop side until `done` holds; true if it did within a second
+static bool loopUntil(std::function<bool(bool)> done) {
+  for (int i = 0; i < 1000; i++) {
+    if (done(ota->loop(clock_now()))) return true;
+    delay(1);
+  }
+  return false;
+}
+
+// Sends chunks from `from` on in order, looping after each like the firmware does between MQTT messages
+static bool sendFrom(uint32_t from, const std::vector<uint8_t>& data = image) {
+  bool ready = false;
+  for (uint32_t i = from; i < IMAGE_CHUNKS; i++) {
+    chunk(i, data);
+    ready |= ota->loop(clock_now());
+  }
+  return ready || loopUntil([](bool ready) { return ready; });
+}
+
+// A fresh MqttOta on the same flash and NVS, as after a restart (the old writer task stays parked)
+static void restart() {
+  ota = new MqttOta(*pubsub, preferences);
+  pubsub->messages.clear();
+}
+
+static void assertFlashed() {
+  auto& partition = ota_shim_update_partition();
+  TEST_ASSERT_EQUAL_MEMORY(image.data(), partition.flash.data(), image.size());
+  TEST_ASSERT_EQUAL_PTR(&partition, ota_shim_boot_partition());
+  TEST_ASSERT_FALSE(preferences.isKey("ota_sha"));
+  TEST_ASSERT_FALSE(preferences.isKey("ota_off"));
+}
+
+void test_transfer_with_short_last_chunk() {
+  begin();
+  TEST_ASSERT_EQUAL_STRING("receiving", pubsub->last("status").c_str());
+  TEST_ASSERT_EQUAL_INT(0, pubsub->progress());
+
+  TEST_ASSERT_TRUE(sendFrom(0));
+  assertFlashed();
+
+  // Rounded up after the short chunk, and both final messages bypass the queue: the caller reboots right away
+  bool immediate = false;
+  TEST_ASSERT_EQUAL_INT(IMAGE_CHUNKS, atoi(pubsub->last("progress", &immediate).c_str()));
+  TEST_ASSERT_TRUE(immediate);
+  TEST_ASSERT_EQUAL_STRING("verified", pubsub->last("status", &immediate).c_str());
+  TEST_ASSERT_TRUE(immediate);
+}
+
+void test_out_of_order_and_duplicate_chunks() {
+  begin();
+  chunk(1);                                   // ahead: ignored, sender is told to rewind
+  TEST_ASSERT_EQUAL_INT(0, pubsub->progress());
+  chunk(0);
+  chunk(0);                                   // duplicate
+  TEST_ASSERT_EQUAL_INT(1, pubsub->progress());
+  chunk(3);
+  TEST_ASSERT_EQUAL_INT(1, pubsub->progress());
+
+  TEST_ASSERT_TRUE(sendFrom(1));
+  assertFlashed();
+}
+
+void test_short_chunk_before_the_end_is_refused() {
+  begin();
+  std::vector<uint8_t> payload = { 0, 0, 0, 0, 1, 2, 3 };
+  ota->onChunk(payload.data(), payload.size());
+  TEST_ASSERT_EQUAL_INT(0, pubsub->progress());
+  TEST_ASSERT_TRUE(sendFrom(0));
+}
+
+void test_resume_after_restart() {
+  begin();
+  for (uint32_t i = 0; i < 2 * OTA_MQTT_SECTOR_SIZE / CHUNK_SIZE + 2; i++) chunk(i);
+  TEST_ASSERT_TRUE(loopUntil([](bool) { return preferences.getULong("ota_off") == 2 * OTA_MQTT_SECTOR_SIZE; }));
+
+  // Flushed sectors are rehashed from flash; the chunks of the unflushed sector are asked for again
+  restart();
+  begin();
+  TEST_ASSERT_EQUAL_STRING("receiving", pubsub->last("status").c_str());
+  TEST_ASSERT_EQUAL_INT(2 * OTA_MQTT_SECTOR_SIZE / CHUNK_SIZE, pubsub->progress());
+
+  TEST_ASSERT_TRUE(sendFrom(pubsub->progress()));
+  assertFlashed();
+}
+
+void test_other_image_starts_over() {
+  begin();
+  for (uint32_t i = 0; i < OTA_MQTT_SECTOR_SIZE / CHUNK_SIZE; i++) chunk(i);
+  TEST_ASSERT_TRUE(loopUntil([](bool) { return preferences.getULong("ota_off") == OTA_MQTT_SECTOR_SIZE; }));
+
+  restart();
+  image[10] ^= 0xff;
+  begin();
+  TEST_ASSERT_EQUAL_INT(0, pubsub->progress());
+  TEST_ASSERT_TRUE(sendFrom(0));
+  assertFlashed();
+}
+
+void test_sha256_mismatch() {
+  begin();
+  auto corrupted = image;
+  corrupted[IMAGE_SIZE - 1] ^= 0x01;
+
+  TEST_ASSERT_FALSE(sendFrom(0, corrupted));
+  TEST_ASSERT_EQUAL_STRING("failed:sha256_mismatch", pubsub->last("status").c_str());
+  TEST_ASSERT_NULL(ota_shim_boot_partition());
+}
+
+void test_flash_write_error() {
+  begin();
+  ota_shim_update_partition().failWrites = true;
+  TEST_ASSERT_FALSE(sendFrom(0));
+  TEST_ASSERT_EQUAL_STRING("failed:flash_write", pubsub->last("status").c_str());
+}
+
+// The new image is only booted once the sender heard "verified", else it would send begin to the new firmware
+void test_verified_waits_for_the_connection() {
+  begin();
+  pubsub->connected = false;
+  TEST_ASSERT_FALSE(sendFrom(0));
+  TEST_ASSERT_EQUAL_STRING("receiving", pubsub->last("status").c_str());
+
+  pubsub->connected = true;
+  TEST_ASSERT_TRUE(ota->loop(clock_now()));
+  TEST_ASSERT_EQUAL_STRING("verified", pubsub->last("status").c_str());
+}
+
+void test_begin_after_verified_is_not_a_new_session() {
+  begin();
+  TEST_ASSERT_TRUE(sendFrom(0));
+  pubsub->messages.clear();
+
+  begin();
+  TEST_ASSERT_EQUAL_STRING("verified", pubsub->last("status").c_str());
+  TEST_ASSERT_FALSE(preferences.isKey("ota_sha"));
+}
+
+void test_rejects_bad_begin() {
+  const char* bad[] = { "", "100 1024", "100 1000 00", "0 1024 " "0000000000000000000000000000000000000000000000000000000000000000" };
+  for (auto text : bad) {
+    ota->onBegin((uint8_t*)text, strlen(text));
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("failed:", pubsub->last("status").substr(0, 7).c_str(), text);
+    TEST_ASSERT_FALSE(ota->isActive());
+  }
+}
+
+void setUp() {
+  image.resize(IMAGE_SIZE);
+  for (size_t i = 0; i < image.size(); i++) image[i] = (uint8_t)(i * 131 + (i >> 9));
+
+  auto& partition = ota_shim_update_partition();
+  std::fill(partition.flash.begin(), partition.flash.end(), 0xff);
+  partition.failWrites = false;
+  ota_shim_boot_partition() = NULL;
+  Preferences::store().clear();
+
+  pubsub = new PubSub();
+  ota = new MqttOta(*pubsub, preferences);
+}
+
+void tearDown() { }
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_transfer_with_short_last_chunk);
+  RUN_TEST(test_out_of_order_and_duplicate_chunks);
+  RUN_TEST(test_short_chunk_before_the_end_is_refused);
+  RUN_TEST(test_resume_after_restart);
+  RUN_TEST(test_other_image_starts_over);
+  RUN_TEST(test_sha256_mismatch);
+  RUN_TEST(test_flash_write_error);
+  RUN_TEST(test_verified_waits_for_the_connection);
+  RUN_TEST(test_begin_after_verified_is_not_a_new_session);
+  RUN_TEST(test_rejects_bad_begin);
+  return UNITY_END();
+}
@@ -0,0 +1,353 @@
+#!/usr/bin/env python3
+# Bytes-on-the-wire benchmark for MQTT 3.1.1 vs MQTT 5 with topic aliases (see lib/mqtt/src/MqttClient.h).
+#
+# A minimal broker stand-in counts every byte the client sends and resolves topic aliases,
+# failing loudly on an alias it was never told about.
+#
+#   ./tools/mqtt_bytes_bench.py native                         # the real MqttClient, built for the host (g++)
+#   ./tools/mqtt_bytes_bench.py native --protocol 4            # ... against a 3.1.1-only broker (fallback)
+#   ./tools/mqtt_bytes_bench.py native --hangup 1              # ... against a broker that hangs up on level 5
+#   ./tools/mqtt_bytes_bench.py native --keep-alive 120        # ... against a broker that sets Server Keep Alive
+#   ./tools/mqtt_bytes_bench.py serve --listen 0.0.0.0:1883    # point the device (MQTT_SERVER_NAME) here
+#   ./tools/mqtt_bytes_bench.py simulate                       # Python model of the client, no compiler needed
+
+import argparse
+import collections
+import os
+import random
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+
+PREFIX = 'dev/roller-02'
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..')
+
+def varint(n):
+  out = bytearray()
+  while True:
+    b = n & 0x7F
+    n >>= 7
+    out.append(b | 0x80 if n else b)
+    if not n: return bytes(out)
+
+def string(s):
+  s = s.encode() if isinstance(s, str) else s
+  return struct.pack('>H', len(s)) + s
+
+def packet(header, body):
+  return bytes([header]) + varint(len(body)) + body
+
+def read_varint(data, pos):
+  value, shift = 0, 0
+  while True:
+    b = data[pos]
+    pos += 1
+    value |= (b & 0x7F) << shift
+    if not b & 0x80: return value, pos
+    shift += 7
+
+class Stats:
+  def __init__(self):
+    self.bytes = collections.Counter()
+    self.publishes = collections.Counter()
+    self.protocol = None
+
+  def report(self, out=sys.stdout):
+    total = sum(self.publishes.values())
+    publish_bytes = self.bytes['publish']
+    print('protocol level {}: {} publishes, {} bytes total, {} bytes of PUBLISH, {:.1f} bytes/publish'.format(
+      self.protocol, total, sum(self.bytes.values()), publish_bytes, publish_bytes / total if total else 0), file=out)
+
+# One client connection: answers CONNECT/SUBSCRIBE/PINGREQ and tallies PUBLISH bytes per topic
+class StandIn:
+  def __init__(self, protocol=5, alias_max=10, verbose=False, hangup=False, keep_alive=0):
+    self.accept_protocol = protocol
+    self.alias_max = alias_max
+    self.keep_alive = keep_alive
+    self.verbose = verbose
+    self.hangup = hangup
+    self.stats = Stats()
+    self.protocol = None
+    self.aliases = {}
+
+  def handle(self, data, send):
+    header = data[0]
+    length, pos = read_varint(data, 1)
+    body = data[pos:pos + length]
+    kind = header & 0xF0
+
+    if kind == 0x10:
+      self.stats.bytes['connect'] += len(data)
+      level = body[6]
+      self.stats.protocol = level
+      if level > self.accept_protocol and self.hangup:
+        return False                            # some 3.1.1 brokers just close the connection
+      if level > self.accept_protocol:
+        send(packet(0x20, b'\x00\x01'))     # 3.1.1: unacceptable protocol version
+        return False
+      self.protocol = level
+      self.aliases = {}
+      if level == 5:
+        props = b'\x22' + struct.pack('>H', self.alias_max) if self.alias_max else b''
+        if self.keep_alive: props += b'\x13' + struct.pack('>H', self.keep_alive)
+        send(packet(0x20, b'\x00\x00' + varint(len(props)) + props))
+      else:
+        send(packet(0x20, b'\x00\x00'))
+    elif kind == 0x30:
+      self.stats.bytes['publish'] += len(data)
+      topic_length = struct.unpack_from('>H', body)[0]
+      topic = body[2:2 + topic_length].decode()
+      pos = 2 + topic_length
+      if (header >> 1) & 3: pos += 2
+      if self.protocol == 5:
+        props_length, pos = read_varint(body, pos)
+        props = body[pos:pos + props_length]
+        pos += props_length
+        if props[:1] == b'\x23':
+          alias = struct.unpack_from('>H', props, 1)[0]
+          if alias == 0 or alias > self.alias_max: raise ValueError('alias {} out of range'.format(alias))
+          if topic: self.aliases[alias] = topic
+          elif alias in self.aliases: topic = self.aliases[alias]
+          else: raise ValueError('unknown topic alias {}'.format(alias))
+      if not topic: raise ValueError('publish without topic')
+      self.stats.publishes[topic] += 1
+      if self.verbose: print('{:4d} B  {} = {!r}'.format(len(data), topic, bytes(body[pos:])))
+    elif kind == 0x80:
+      self.stats.bytes['subscribe'] += len(data)
+      send(packet(0x90, body[:2] + (b'\x00' if self.protocol == 5 else b'') + b'\x00'))
+    elif kind == 0xC0:
+      self.stats.bytes['ping'] += len(data)
+      send(packet(0xD0, b''))
+    elif kind == 0xE0:
+      return False
+    return True
+
+def split_packets(buffer):
+  packets = []
+  while len(buffer) >= 2:
+    try: length, pos = read_varint(buffer, 1)
+    except IndexError: break
+    if len(buffer) < pos + length: break
+    packets.append(bytes(buffer[:pos + length]))
+    del buffer[:pos + length]
+  return packets
+
+# Feeds one connection to the stand-in until either side hangs up
+def converse(conn, standin):
+  buffer = bytearray()
+  try:
+    alive = True
+    while alive:
+      data = conn.recv(4096)
+      if not data: break
+      buffer += data
+      for p in split_packets(buffer):
+        alive = standin.handle(p, conn.sendall)
+        if not alive: break
+  finally:
+    conn.close()
+
+def serve(args):
+  host, port = args.listen.rsplit(':', 1)
+  server = socket.socket()
+  server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+  server.bind((host, int(port)))
+  server.listen(1)
+  print('broker stand-in on {} (protocol <= {}, topic alias maximum {})'.format(args.listen, args.protocol, args.alias_max))
+
+  while True:
+    conn, peer = server.accept()
+    standin = StandIn(args.protocol, args.alias_max, verbose=True, hangup=args.hangup, keep_alive=args.keep_alive)
+    try:
+      converse(conn, standin)
+    except KeyboardInterrupt:
+      standin.stats.report()
+      return
+    if standin.stats.protocol: standin.stats.report()
+
+# Builds tools/mqtt_host/mqtt_host_client.cpp: lib/mqtt/src/MqttClient.h over a POSIX socket
+def build_host_client(cxx, directory):
+  binary = os.path.join(directory, 'mqtt_host_client')
+  subprocess.check_call([cxx, '-std=gnu++11', '-O2', '-Wall',
+    '-I', os.path.join(ROOT, 'tools', 'mqtt_host'), '-I', os.path.join(ROOT, 'lib', 'mqtt', 'src'),
+    os.path.join(ROOT, 'tools', 'mqtt_host', 'mqtt_host_client.cpp'), '-o', binary])
+  return binary
+
+# Runs the mix through the real client against a stand-in on an ephemeral port, one StandIn per connection
+def run_host_client(binary, protocol, mix, args):
+  server = socket.socket()
+  server.bind(('127.0.0.1', 0))
+  server.listen(1)
+  server.settimeout(0.2)
+  standins, done = [], threading.Event()
+
+  def accept():
+    while not done.is_set():
+      try: conn, peer = server.accept()
+      except socket.timeout: continue
+      conn.settimeout(None)
+      standins.append(StandIn(args.protocol, args.alias_max, hangup=args.hangup, keep_alive=args.keep_alive))
+      converse(conn, standins[-1])
+
+  thread = threading.Thread(target=accept)
+  thread.start()
+  try:
+    lines = ''.join('{}\t{}\t{}\n'.format(int(retained), topic, payload) for topic, payload, retained in mix)
+    result = subprocess.run([binary, '127.0.0.1', str(server.getsockname()[1]), str(protocol)],
+      input=lines, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True, timeout=60)
+  finally:
+    done.set()
+    thread.join()
+    server.close()
+
+  sys.stdout.write(result.stdout)
+  if result.returncode != 0: raise RuntimeError('host client failed ({})'.format(result.returncode))
+  return standins[-1].stats
+
+def native(args):
+  mix = list(typical_mix(args.seed, args.changes))
+  results = {}
+  with tempfile.TemporaryDirectory() as directory:
+    binary = build_host_client(args.cxx, directory)
+    for protocol in (4, 5):
+      print('-- MqttClient, protocol level {} requested'.format(protocol))
+      stats = run_host_client(binary, protocol, mix, args)
+      stats.report()
+      results[protocol] = stats.bytes['publish']
+
+  print('PUBLISH bytes (MqttClient, host build): {} -> {} ({:.0f}% less with topic aliases)'.format(
+    results[4], results[5], 100. * (results[4] - results[5]) / results[4]))
+
+# Python model of MqttClient's encoder (alias on the 2nd publish of a topic, bounded by the broker maximum);
+# 'native' measures the real client
+class ModelClient:
+  def __init__(self, protocol, alias_after=2):
+    self.protocol = protocol
+    self.alias_after = alias_after
+    self.seen = collections.Counter()
+    self.aliases = {}
+    self.alias_max = 0
+
+  def connect(self, standin):
+    reply = []
+    body = string('MQTT') + bytes([self.protocol, 0x02]) + struct.pack('>H', 15)
+    if self.protocol == 5: body += b'\x00'
+    body += string('roller-02')
+    standin.handle(packet(0x10, body), reply.append)
+
+    connack = reply[0]
+    if connack[3] != 0: return False
+    if self.protocol == 5 and len(connack) > 4:
+      props = connack[5:]
+      if props[:1] == b'\x22': self.alias_max = struct.unpack_from('>H', props, 1)[0]
+    return True
+
+  def publish(self, standin, topic, payload, retained=False):
+    alias, send_topic = 0, True
+    if self.protocol == 5 and self.alias_max:
+      if topic in self.aliases:
+        alias, send_topic = self.aliases[topic], False
+      else:
+        self.seen[topic] += 1
+        if self.seen[topic] >= self.alias_after and len(self.aliases) < self.alias_max:
+          alias = self.aliases[topic] = len(self.aliases) + 1
+
+    body = string(topic if send_topic else '')
+    if self.protocol == 5: body += (b'\x03\x23' + struct.pack('>H', alias)) if alias else b'\x00'
+    body += payload.encode()
+    standin.handle(packet(0x30 | (1 if retained else 0), body), None)
+
+def event(state, up_us):
+  return '{{"state":"{}","up_us":{},"ts_us":{}}}'.format(state, up_us, 1760000000000000 + up_us)
+
+def travel(mean_ms, sigma_ms, samples, limit_ms):
+  model = '{{"mean_ms":{},"sigma_ms":{},"samples":{},"limit_ms":{}}}'.format(mean_ms, sigma_ms, samples, limit_ms)
+  return '{{"up":{},"down":{}}}'.format(model, model)
+
+# A day of a typical device, with the payloads the firmware sends: restart burst, then state changes of
+# blinds, audio relay and button (each a retained <name>/state plus a <name>/event), travel model updates
+# after full runs and the periodic /power/stats
+def typical_mix(seed=1, changes=500):
+  rnd = random.Random(seed)
+  up_us = 4000000
+
+  def change(name, state):
+    yield PREFIX + '/' + name + '/state', state, True
+    yield PREFIX + '/' + name + '/event', event(state, up_us), False
+
+  yield PREFIX + '/status', 'online', True
+  yield PREFIX + '/version', '1.4.0', True
+  for n, payload in (('0', 'POWERON_RESET'), ('1', 'NO_MEAN'), ('uptime', '86400123'), ('code', '0'), ('sw', 'NONE'),
+                     ('run_id', '117'), ('online_ms', '1840'), ('wifi_connect_mode', '2')):
+    yield PREFIX + '/restart_reason/' + n, payload, True
+  yield PREFIX + '/blinds/state', 'FullUp', True
+  yield PREFIX + '/blinds/travel', travel(21340, 212, 14, 24340), True
+  yield PREFIX + '/audio/state', '0', True
+  yield PREFIX + '/button_1/state', '0', True
+
+  for i in range(changes):
+    up_us += rnd.randint(10, 600) * 1000000
+    r = rnd.random()
+    if r < 0.4:
+      for m in change('button_1', '1'): yield m
+      for m in change('button_1', '0'): yield m
+      for m in change('audio', rnd.choice('01')): yield m
+    elif r < 0.8:
+      for m in change('blinds', rnd.choice(['RollingUp', 'RollingDown'])): yield m
+      end = rnd.choice(['FullUp', 'FullDown', 'FullUp', 'FullDown', 'Stopped'])
+      for m in change('blinds', end): yield m
+      if end != 'Stopped': yield PREFIX + '/blinds/travel', travel(21340 + rnd.randint(-300, 300), 212, 15, 24340), True
+    else:
+      yield PREFIX + '/power/stats', ('{{"mode":1,"listen_interval":3,"window_ms":60000,"idle_ms":{},"gpio_wakeups":{},'
+        '"commands":{},"cmd_wait_avg_ms":{},"cmd_wait_max_ms":{}}}').format(
+        rnd.randint(57000, 59800), rnd.randint(0, 9), rnd.randint(0, 4), rnd.randint(0, 150), rnd.randint(0, 300)), False
+
+def simulate(args):
+  results = {}
+  for protocol in (4, 5):
+    standin = StandIn(5, args.alias_max)
+    client = ModelClient(protocol)
+    if not client.connect(standin): raise RuntimeError('connect refused')
+    for topic, payload, retained in typical_mix(args.seed, args.changes):
+      client.publish(standin, topic, payload, retained)
+    standin.stats.report()
+    results[protocol] = standin.stats.bytes['publish']
+
+  print('PUBLISH bytes (Python model, not the firmware): {} -> {} ({:.0f}% less with topic aliases)'.format(
+    results[4], results[5], 100. * (results[4] - results[5]) / results[4]))
+
+def main():
+  parser = argparse.ArgumentParser()
+  sub = parser.add_subparsers(dest='command', required=True)
+
+  p = sub.add_parser('native', help='build MqttClient for the host and run the typical mix through it, 3.1.1 vs 5')
+  p.add_argument('--alias-max', type=int, default=10, help='broker Topic Alias Maximum (mosquitto default: 10)')
+  p.add_argument('--protocol', type=int, choices=(4, 5), default=5, help='highest protocol level the stand-in accepts')
+  p.add_argument('--hangup', type=int, choices=(0, 1), default=0, help='close the connection instead of refusing a level in CONNACK')
+  p.add_argument('--keep-alive', type=int, default=0, help='Server Keep Alive sent in a level 5 CONNACK, 0 for none')
+  p.add_argument('--changes', type=int, default=500)
+  p.add_argument('--seed', type=int, default=1)
+  p.add_argument('--cxx', default=os.environ.get('CXX', 'g++'))
+
+  p = sub.add_parser('simulate', help='run the typical mix through a Python model of the client, 3.1.1 vs 5')
+  p.add_argument('--alias-max', type=int, default=10, help='broker Topic Alias Maximum (mosquitto default: 10)')
+  p.add_argument('--changes', type=int, default=500)
+  p.add_argument('--seed', type=int, default=1)
+
+  p = sub.add_parser('serve', help='broker stand-in for a real device, reports bytes per connection')
+  p.add_argument('--listen', default='0.0.0.0:1883')
+  p.add_argument('--protocol', type=int, choices=(4, 5), default=5, help='highest protocol level accepted')
+  p.add_argument('--hangup', type=int, choices=(0, 1), default=0, help='close the connection instead of refusing a level in CONNACK')
+  p.add_argument('--alias-max', type=int, default=10)
+  p.add_argument('--keep-alive', type=int, default=0, help='Server Keep Alive sent in a level 5 CONNACK, 0 for none')
+
+  args = parser.parse_args()
+  if args.command == 'native': native(args)
+  elif args.command == 'simulate': simulate(args)
+  else: serve(args)
+
+if __name__ == '__main__':
+  main()
@@ -0,0 +1,23 @@
+// Just enough of the Arduino core for lib/mqtt on a POSIX host (see tools/mqtt_bytes_bench.py native)
+#ifndef ARDUINO_HOST_H
+#define ARDUINO_HOST_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+
+typedef bool boolean;
+
+inline unsigned long millis() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+inline void yield() {
+  sched_yield();
+}
+
+#endif
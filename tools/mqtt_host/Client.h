@@ -0,0 +1,20 @@
+#ifndef CLIENT_HOST_H
+#define CLIENT_HOST_H
+
+#include <Arduino.h>
+#include <IPAddress.h>
+
+class Client {
+  public:
+    virtual ~Client() { }
+    virtual int connect(IPAddress ip, uint16_t port) = 0;
+    virtual int connect(const char* host, uint16_t port) = 0;
+    virtual size_t write(const uint8_t* buf, size_t size) = 0;
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual void flush() = 0;
+    virtual void stop() = 0;
+    virtual uint8_t connected() = 0;
+};
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef IPADDRESS_HOST_H
+#define IPADDRESS_HOST_H
+
+#include <stdint.h>
+
+class IPAddress {
+  public:
+    IPAddress(uint32_t address = 0) : address(address) { }
+    operator uint32_t() const { return address; }
+
+  private:
+    uint32_t address;
+};
+
+#endif
@@ -0,0 +1,136 @@
+// Host build of lib/mqtt over a POSIX socket, driven by tools/mqtt_bytes_bench.py native.
+//
+//   mqtt_host_client HOST PORT PROTOCOL < publishes
+//
+// Reads one publish per line as "<retained 0|1>\t<topic>\t<payload>", publishes it through
+// the real MqttClient and prints what the client negotiated and put on the wire.
+
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <iostream>
+#include <MqttClient.h>
+
+#define CONNECT_ATTEMPTS              4
+
+class SocketClient : public Client {
+  public:
+    int connect(IPAddress ip, uint16_t port) {
+      sockaddr_in addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sin_family = AF_INET;
+      addr.sin_port = htons(port);
+      addr.sin_addr.s_addr = (uint32_t)ip;
+      return open((sockaddr*)&addr, sizeof(addr));
+    }
+
+    int connect(const char* host, uint16_t port) {
+      addrinfo hints, *found;
+      memset(&hints, 0, sizeof(hints));
+      hints.ai_family = AF_INET;
+      hints.ai_socktype = SOCK_STREAM;
+      if (getaddrinfo(host, std::to_string(port).c_str(), &hints, &found) != 0) return 0;
+
+      int result = open(found->ai_addr, found->ai_addrlen);
+      freeaddrinfo(found);
+      return result;
+    }
+
+    size_t write(const uint8_t* buf, size_t size) {
+      size_t sent = 0;
+      while (fd >= 0 && sent < size) {
+        ssize_t n = send(fd, buf + sent, size - sent, MSG_NOSIGNAL);
+        if (n <= 0) break;
+        sent += n;
+      }
+      return sent;
+    }
+
+    int available() {
+      int n = 0;
+      return fd >= 0 && ioctl(fd, FIONREAD, &n) == 0 ? n : 0;
+    }
+
+    int read() {
+      uint8_t b;
+      return fd >= 0 && recv(fd, &b, 1, 0) == 1 ? b : -1;
+    }
+
+    void flush() { }
+
+    void stop() {
+      if (fd >= 0) close(fd);
+      fd = -1;
+    }
+
+    // Open until the peer hangs up and everything it sent was read
+    uint8_t connected() {
+      if (fd < 0) return 0;
+      uint8_t b;
+      ssize_t n = recv(fd, &b, 1, MSG_PEEK | MSG_DONTWAIT);
+      return n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+    }
+
+  private:
+    int fd = -1;
+
+    int open(const sockaddr* addr, socklen_t length) {
+      stop();
+      fd = socket(AF_INET, SOCK_STREAM, 0);
+      if (fd < 0) return 0;
+
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      if (::connect(fd, addr, length) != 0) {
+        stop();
+        return 0;
+      }
+      return 1;
+    }
+};
+
+int main(int argc, char** argv) {
+  if (argc < 4) {
+    fprintf(stderr, "usage: %s HOST PORT PROTOCOL < publishes\n", argv[0]);
+    return 2;
+  }
+
+  SocketClient socket;
+  MqttClient client(socket);
+  client.setServer(argv[1], atoi(argv[2]));
+  client.setProtocolVersion(atoi(argv[3]));
+  client.setBufferSize(1024);
+
+  int attempts = 0;
+  while (!client.connect("roller-02", NULL, NULL, "dev/roller-02/status", MQTTQOS0, true, "offline")) {
+    fprintf(stderr, "connect failed: state %d, protocol level %d\n", client.state(), client.getProtocolVersion());
+    if (++attempts == CONNECT_ATTEMPTS) return 1;
+  }
+  printf("connected protocol=%d keepalive=%u attempts=%d\n", client.getProtocolVersion(), client.getKeepAlive(), attempts + 1);
+
+  std::string line;
+  unsigned long publishes = 0;
+  while (std::getline(std::cin, line)) {
+    auto topicEnd = line.find('\t', 2);
+    if (line.size() < 3 || topicEnd == std::string::npos) continue;
+
+    auto topic = line.substr(2, topicEnd - 2);
+    auto payload = line.substr(topicEnd + 1);
+    if (!client.publish(topic.c_str(), (const uint8_t*)payload.data(), payload.size(), line[0] == '1')) {
+      fprintf(stderr, "publish failed: %s\n", topic.c_str());
+      return 1;
+    }
+    publishes++;
+    client.loop();
+  }
+
+  client.disconnect();
+  printf("publishes=%lu sent=%lu received=%lu aliases=%u\n", publishes, client.getBytesSent(), client.getBytesReceived(), client.getTopicAliasCount());
+  return 0;
+}
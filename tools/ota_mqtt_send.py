@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+# Sends a firmware image to the device over MQTT (see src/ota_mqtt.h), resuming from
+# whatever chunk the device reports on <prefix>/ota/progress.
+#
+#   pip install paho-mqtt
+#   ./tools/ota_mqtt_send.py --host 127.0.0.1 --prefix dev/roller-02 .pio/build/esp32-release/firmware.bin
+
+import argparse
+import hashlib
+import struct
+import sys
+import threading
+import time
+
+import paho.mqtt.client as mqtt
+
+def main():
+  parser = argparse.ArgumentParser()
+  parser.add_argument('--host', default='127.0.0.1')
+  parser.add_argument('--port', type=int, default=1883)
+  parser.add_argument('--username')
+  parser.add_argument('--password')
+  parser.add_argument('--prefix', default='dev/roller-02')
+  parser.add_argument('--chunk-size', type=int, default=1024)
+  parser.add_argument('--window', type=int, default=8, help='chunks in flight ahead of the last reported progress')
+  parser.add_argument('--timeout', type=float, default=10., help='seconds without progress before re-sending begin')
+  parser.add_argument('firmware')
+  args = parser.parse_args()
+
+  with open(args.firmware, 'rb') as f: image = f.read()
+  chunks = (len(image) + args.chunk_size - 1) // args.chunk_size
+  begin = '{} {} {}'.format(len(image), args.chunk_size, hashlib.sha256(image).hexdigest())
+
+  state = { 'next': None, 'status': None, 'updated': threading.Event() }
+
+  def on_connect(client, userdata, flags, rc):
+    client.subscribe(args.prefix + '/ota/progress')
+    client.subscribe(args.prefix + '/ota/status')
+    client.publish(args.prefix + '/ota/begin', begin)
+
+  def on_message(client, userdata, msg):
+    if msg.topic.endswith('/ota/progress'): state['next'] = int(msg.payload)
+    else: state['status'] = msg.payload.decode()
+    state['updated'].set()
+
+  client = mqtt.Client()
+  if args.username: client.username_pw_set(args.username, args.password)
+  client.on_connect = on_connect
+  client.on_message = on_message
+  client.connect(args.host, args.port)
+  client.loop_start()
+
+  sent = 0
+  started = time.time()
+  while True:
+    if not state['updated'].wait(args.timeout):
+      # Everything is in flash and the device went quiet: it has most likely booted the image already,
+      # and a begin would now start flashing it over again
+      if state['next'] == chunks:
+        print('\nall chunks acknowledged but no verified status, check the device before sending again')
+        return 2
+      print('\nno progress, re-sending begin')
+      client.publish(args.prefix + '/ota/begin', begin)
+      continue
+    state['updated'].clear()
+
+    status = state['status']
+    if status == 'verified':
+      print('\nverified, device is rebooting ({:.1f}s)'.format(time.time() - started))
+      return 0
+    if status and status.startswith('failed'):
+      print('\n' + status)
+      return 1
+
+    nxt = state['next']
+    if nxt is None: continue
+
+    # Rewind on resume, otherwise keep the window full
+    if sent < nxt or sent > nxt + args.window: sent = nxt
+    while sent < min(nxt + args.window, chunks):
+      data = image[sent * args.chunk_size:(sent + 1) * args.chunk_size]
+      client.publish(args.prefix + '/ota/chunk', struct.pack('<I', sent) + data)
+      sent += 1
+
+    sys.stdout.write('\r{}/{} chunks'.format(nxt, chunks))
+    sys.stdout.flush()
+
+if __name__ == '__main__':
+  sys.exit(main())
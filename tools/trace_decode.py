@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+# Turns binary trace frames (see lib/trace/src/Trace.h) back into text, using the
+# event registry in lib/trace/src/TraceEvents.h for names and formats.
+#
+#   ./tools/trace_decode.py --serial /dev/ttyACM0        (pip install pyserial)
+#   ./tools/trace_decode.py --mqtt 127.0.0.1             (pip install paho-mqtt)
+#   ./tools/trace_decode.py capture.bin
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+HEADER = struct.Struct('<2sBBI')
+RECORD = struct.Struct('<IHHII')   # timestamp bits 0..31, id, timestamp bits 32..47, args
+VERSION = 2
+EVENTS_H = os.path.join(os.path.dirname(__file__), '..', 'lib', 'trace', 'src', 'TraceEvents.h')
+
+def load_events(path):
+  events = {}
+  with open(path) as f:
+    for name, id, fmt in re.findall(r'X\((\w+),\s*(\d+),\s*"([^"]*)"\)', f.read()):
+      events[int(id)] = (name, fmt)
+  return events
+
+class Decoder:
+  def __init__(self, events):
+    self.events = events
+    self.buffer = b''
+    self.dropped = 0
+
+  # Feeds raw bytes, yields decoded lines; resyncs on the frame magic so log text in between is skipped
+  def feed(self, data):
+    self.buffer += data
+    while True:
+      start = self.buffer.find(b'TR')
+      if start < 0:
+        self.buffer = self.buffer[-1:]
+        return
+      self.buffer = self.buffer[start:]
+      if len(self.buffer) < HEADER.size: return
+
+      magic, version, count, dropped = HEADER.unpack_from(self.buffer)
+      if version != VERSION or count == 0:
+        self.buffer = self.buffer[2:]
+        continue
+
+      length = HEADER.size + count * RECORD.size
+      if len(self.buffer) < length: return
+
+      for line in self.frame(self.buffer[HEADER.size:length], count, dropped): yield line
+      self.buffer = self.buffer[length:]
+
+  def frame(self, data, count, dropped):
+    if dropped < self.dropped:
+      yield '-- device restarted'
+      self.dropped = 0
+    if dropped != self.dropped:
+      yield '-- {} record(s) dropped on the device'.format(dropped - self.dropped)
+      self.dropped = dropped
+
+    for i in range(count):
+      low, id, high, arg0, arg1 = RECORD.unpack_from(data, i * RECORD.size)
+      name, fmt = self.events.get(id, ('EVENT_{}'.format(id), '%u %u'))
+      try: text = fmt % (arg0, arg1)
+      except TypeError: text = fmt % ((arg0, arg1)[:fmt.count('%')])
+      yield '{:12.6f}  {:<24} {}'.format((high << 32 | low) / 1e6, name, text)
+
+def main():
+  parser = argparse.ArgumentParser()
+  parser.add_argument('--serial', help='serial port of the device (TRACE_OUTPUT_SERIAL)')
+  parser.add_argument('--baud', type=int, default=115200)
+  parser.add_argument('--mqtt', metavar='HOST', help='broker to read <prefix>/trace from (TRACE_OUTPUT_MQTT)')
+  parser.add_argument('--port', type=int, default=1883)
+  parser.add_argument('--username')
+  parser.add_argument('--password')
+  parser.add_argument('--prefix', default='dev/roller-02')
+  parser.add_argument('--events', default=EVENTS_H)
+  parser.add_argument('file', nargs='?', help='captured raw frames, - for stdin')
+  args = parser.parse_args()
+
+  decoder = Decoder(load_events(args.events))
+  def emit(data):
+    for line in decoder.feed(data): print(line, flush=True)
+
+  if args.mqtt:
+    import paho.mqtt.client as mqtt
+
+    client = mqtt.Client()
+    if args.username: client.username_pw_set(args.username, args.password)
+    client.on_connect = lambda c, u, f, rc: c.subscribe(args.prefix + '/trace')
+    client.on_message = lambda c, u, m: emit(m.payload)
+    client.connect(args.mqtt, args.port)
+    client.loop_forever()
+  elif args.serial:
+    import serial
+
+    with serial.Serial(args.serial, args.baud) as port:
+      while True: emit(port.read(max(1, port.in_waiting)))
+  else:
+    f = sys.stdin.buffer if args.file in (None, '-') else open(args.file, 'rb')
+    while True:
+      data = f.read(4096)
+      if not data: break
+      emit(data)
+
+if __name__ == '__main__':
+  try: main()
+  except KeyboardInterrupt: pass